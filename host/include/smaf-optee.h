@@ -0,0 +1,56 @@
+/*
+ * smaf-optee.h
+ *
+ * Copyright (C) Linaro SA 2015
+ * Author: Benjamin Gaignard <benjamin.gaignard@linaro.org> for Linaro.
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#ifndef _SMAF_OPTEE_H_
+#define _SMAF_OPTEE_H_
+
+#include <linux/device.h>
+#include <linux/dma-direction.h>
+#include <linux/scatterlist.h>
+
+/**
+ * struct smaf_optee_stage - a device of a pipeline
+ *
+ * @dev: the device
+ * @dir: access direction of the device to the buffers
+ */
+struct smaf_optee_stage {
+	struct device *dev;
+	enum dma_data_direction dir;
+};
+
+bool smaf_optee_grant_access_sg(void *ctx, struct device *dev,
+				struct sg_table *sgt,
+				enum dma_data_direction direction);
+
+void smaf_optee_revoke_access_sg(void *ctx, struct device *dev,
+				 struct sg_table *sgt,
+				 enum dma_data_direction direction);
+
+int smaf_optee_register_pipeline(const char *name,
+				 const struct smaf_optee_stage *stages,
+				 unsigned int nr_stages);
+
+void smaf_optee_unregister_pipeline(const char *name);
+
+bool smaf_optee_apply_pipeline(void *ctx, const char *name,
+			       size_t addr, size_t size);
+
+int smaf_optee_apply_pipeline_pool(unsigned int pool, const char *name);
+
+/*
+ * limits of the TA (MAX_POOLS and MAX_POOL_REGIONS in ta/sdp_ta.c): a grant
+ * that would need a pool beyond them is refused
+ */
+#define SMAF_OPTEE_MAX_POOLS		8
+#define SMAF_OPTEE_MAX_POOL_REGIONS	64
+
+int smaf_optee_attach_pool(void *ctx, unsigned int pool);
+
+int smaf_optee_release_pool(unsigned int pool);
+
+#endif
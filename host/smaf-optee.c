@@ -7,15 +7,29 @@
  */
 #include <linux/dma-mapping.h>
 #include <linux/debugfs.h>
+#include <linux/completion.h>
+#include <linux/err.h>
+#include <linux/hashtable.h>
+#include <linux/interval_tree_generic.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/scatterlist.h>
 #include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/smaf-secure.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 /* TODO: cleanup include directories */
 #include <linux/tee_kernel_api.h>
 #include <linux/tee_client_api.h>
 
+#include <smaf-optee.h>
+
 /* Those define are copied from ta_sdp.h */
 #define TA_SDP_UUID { 0xb9aa5f00, 0xd229, 0x11e4, \
 		{ 0x92, 0x5c, 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b} }
@@ -24,41 +38,833 @@
 #define TA_SDP_DESTROY_REGION   1
 #define TA_SDP_UPDATE_REGION    2
 #define TA_SDP_DUMP_STATUS	3
+#define TA_SDP_BATCH		4
+#define TA_SDP_RESOLVE_DEVICE	5
+#define TA_SDP_RING_DRAIN	6
+#define TA_SDP_GET_STATS	7
+#define TA_SDP_CREATE_REGION_SG	8
+#define TA_SDP_RESIZE_REGION	9
+#define TA_SDP_REGISTER_PIPELINE	10
+#define TA_SDP_APPLY_PIPELINE		11
+
+#define TA_SDP_POOL			12
+
+#define SDP_POOL_ADD		0
+#define SDP_POOL_ATTACH		1
+#define SDP_POOL_DETACH		2
+#define SDP_POOL_RELEASE	3
+
+#define TA_SDP_DESTROY_ALL		13
+
+#define TA_SDP_LOOKUP_ADDR		14
+
+#define SDP_NR_COMMANDS		(TA_SDP_LOOKUP_ADDR + 1)
+
+#define SDP_MAX_PIPELINES	8
+#define SDP_MAX_PIPELINE_STAGES	8
+
+#define SDP_MAX_SG_ENTRIES	64
+#define SDP_NO_DEVICE		0xFFFFFFFF
+
+#define SDP_BATCH_ID_REF	(1U << 31)
+
+struct sdp_batch_entry {
+	uint32_t cmd;
+	uint32_t id;
+	uint32_t addr_msb;
+	uint32_t addr_lsb;
+	uint32_t size_msb;
+	uint32_t size_lsb;
+	uint32_t add;
+	uint32_t dir;
+	uint32_t device;
+	uint32_t owner;
+	uint32_t status;
+};
+
+struct sdp_ring {
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t reserved;
+	struct sdp_batch_entry entries[];
+};
+
+struct sdp_ta_stats {
+	uint64_t calls;
+	uint64_t time_us;
+};
+
+struct sdp_sg_entry {
+	uint32_t addr_msb;
+	uint32_t addr_lsb;
+	uint32_t size_msb;
+	uint32_t size_lsb;
+};
+
+struct sdp_pipeline_stage {
+	uint32_t device;
+	uint32_t dir;
+};
+
+#define SDP_PARAM_TYPE_GET(types, i)	(((types) >> ((i) * 4)) & 0xF)
+
+/* latency histogram buckets, bucket n counts calls of [2^n, 2^(n+1)[ ns */
+#define SDP_LATENCY_BUCKETS	32
+
+/**
+ * struct sdp_cmd_stats - statistics of a TA command
+ *
+ * @calls: number of calls
+ * @errors: number of calls which failed
+ * @total_ns: cumulated round trip time
+ * @ta_ns: part of @total_ns spent in the TA, as reported by the TA
+ * @latency: log2 histogram of the round trip time
+ */
+struct sdp_cmd_stats {
+	atomic64_t calls;
+	atomic64_t errors;
+	atomic64_t total_ns;
+	atomic64_t ta_ns;
+	atomic64_t latency[SDP_LATENCY_BUCKETS];
+};
+
+/* operations recorded by the tracer */
+enum sdp_trace_op {
+	SDP_TRACE_CREATE_CTX,
+	SDP_TRACE_DESTROY_CTX,
+	SDP_TRACE_GRANT,
+	SDP_TRACE_REVOKE,
+};
+
+#define SDP_TRACE_NAME_SIZE	24
+
+/**
+ * struct sdp_trace_entry - a traced smaf_secure callback
+ *
+ * This is the binary format read from the trace file and written to the
+ * replay file.
+ *
+ * @time_ns: monotonic time of the call
+ * @addr: DMA address, for grant and revoke
+ * @size: size of the range, for grant and revoke
+ * @client: id of the context
+ * @op: one of enum sdp_trace_op
+ * @dir: DMA direction, for grant and revoke
+ * @failed: the callback returned an error
+ * @device: name used to resolve the device, for grant and revoke
+ */
+struct sdp_trace_entry {
+	uint64_t time_ns;
+	uint64_t addr;
+	uint64_t size;
+	uint32_t client;
+	uint8_t op;
+	uint8_t dir;
+	uint8_t failed;
+	uint8_t reserved;
+	char device[SDP_TRACE_NAME_SIZE];
+};
+
+#define SDP_PIPELINE_NAME_SIZE	32
+
+/**
+ * struct sdp_pipeline - a pipeline, its index is its TA identifier
+ *
+ * @name: name given at registration, empty if the slot is free
+ * @nr_stages: number of stages
+ * @stages: devices and directions, in the pipeline order
+ * @handles: device handles of @stages, valid once registered in the TA
+ * @registered: the pipeline has been registered in the TA
+ * @gen: session generation of the TA registration, it is registered again
+ *	 after a session reset
+ */
+struct sdp_pipeline {
+	char name[SDP_PIPELINE_NAME_SIZE];
+	unsigned int nr_stages;
+	struct smaf_optee_stage stages[SDP_MAX_PIPELINE_STAGES];
+	uint32_t handles[SDP_MAX_PIPELINE_STAGES];
+	bool registered;
+	unsigned int gen;
+};
+
+/**
+ * struct sdp_startup - timings of the sessions bring-up done at load
+ *
+ * @context_us: time to initialize the TEE context
+ * @sessions_us: time to open the sessions, the TA is loaded by the first one
+ * @warmup_us: time of the warm-up command
+ * @total_us: time from module load to the end of the bring-up
+ * @ret: result of the bring-up
+ */
+struct sdp_startup {
+	s64 context_us;
+	s64 sessions_us;
+	s64 warmup_us;
+	s64 total_us;
+	int ret;
+};
 
 struct smaf_optee_device {
 	struct list_head clients_head;
-	/* mutex to serialize list manipulation */
-	struct mutex lock;
+	/* lock to serialize list manipulation */
+	spinlock_t lock;
 	struct dentry *debug_root;
 	TEEC_Context ctx;
-	TEEC_Session session;
+	/* pool of sessions, a call borrows any free one */
+	TEEC_Session *sessions;
+	unsigned int nr_sessions;
+	unsigned long sessions_busy;
+	wait_queue_head_t sessions_wq;
+	/* times a caller found no free session and had to wait */
+	atomic64_t sessions_waits;
+	/* mutex to serialize sessions setup and release */
+	struct mutex session_lock;
 	bool session_initialized;
+	/* sessions bring-up started at load, completed once done or failed */
+	struct work_struct init_work;
+	struct completion init_done;
+	ktime_t init_start;
+	struct sdp_startup startup;
+	/* bumped on each session reset, invalidates the regions shadows */
+	unsigned int session_gen;
+	/* permission shadow cache statistics */
+	atomic64_t shadow_hits;
+	atomic64_t shadow_misses;
+	/* adjacent regions merged and merged regions split again */
+	atomic64_t coalesced;
+	atomic64_t splits;
+	/* TA device handles cache, indexed by struct device */
+	DECLARE_HASHTABLE(devices, 4);
+	spinlock_t devices_lock;
+	/* asynchronous submission ring, NULL if disabled */
+	struct sdp_ring *ring;
+	TEEC_SharedMemory ring_shm;
+	/* region of each queued entry, referenced until the entry is reaped */
+	struct sdp_region **ring_regions;
+	/* lock to serialize producers */
+	spinlock_t ring_lock;
+	/* mutex to serialize ring draining, protects ring_reap */
+	struct mutex ring_drain_lock;
+	/* first entry not yet completed */
+	uint32_t ring_reap;
+	struct work_struct ring_work;
+	atomic64_t ring_errors;
+	/* pipelines, protected by pipelines_lock */
+	struct sdp_pipeline pipelines[SDP_MAX_PIPELINES];
+	struct mutex pipelines_lock;
+	/* buffer pools, protected by pools_lock */
+	struct list_head pools;
+	struct mutex pools_lock;
+	/* per command statistics, since stats_reset */
+	struct sdp_cmd_stats stats[SDP_NR_COMMANDS];
+	ktime_t stats_reset;
+	/* trace ring, NULL if disabled, entries are claimed with trace_head */
+	struct sdp_trace_entry *trace;
+	unsigned int trace_mask;
+	atomic64_t trace_head;
+	atomic_t client_ids;
+};
+
+/**
+ * struct sdp_device - TA handle of a device
+ *
+ * @device_node: node in the devices cache
+ * @dev: the device
+ * @driver: driver bound to @dev when the handle was resolved, the handle is
+ *	    resolved again if it changes
+ * @handle: device handle given by the TA
+ */
+struct sdp_device {
+	struct hlist_node device_node;
+	struct device *dev;
+	struct device_driver *driver;
+	uint32_t handle;
 };
 
 struct sdp_client {
 	struct list_head client_node;
-	struct list_head regions_head;
+	/*
+	 * interval tree of regions indexed by DMA address, looked up under RCU
+	 * and modified with lock held
+	 */
+	struct rb_root regions;
+	seqcount_mutex_t regions_seq;
 	struct mutex lock;
 	const char *name;
+	/* identifies the client in traces */
+	unsigned int id;
+	/* deferred revocations, protected by revoke_lock */
+	struct list_head revokes;
+	unsigned int nr_revokes;
+	struct mutex revoke_lock;
+	struct delayed_work revoke_work;
+	/* pool the regions are added to, protected by so_dev.pools_lock */
+	struct sdp_pool *pool;
 };
 
-struct sdp_region {
-	struct list_head region_node;
+/**
+ * struct sdp_pool - regions kept in the TA across contexts
+ *
+ * @pool_node: node in the pools list
+ * @id: pool identifier, chosen by the user
+ * @gen: generation given by the TA, bumped on each attach
+ * @created: the pool exists in the TA, it is created with its first region
+ * @client: context the pool is attached to, NULL if detached
+ * @regions: regions of the pool, the client tree reference of a region is
+ *	     kept by the pool while it is detached
+ */
+struct sdp_pool {
+	struct list_head pool_node;
+	unsigned int id;
+	uint32_t gen;
+	bool created;
+	struct sdp_client *client;
+	struct list_head regions;
+};
+
+/* number of device handles tracked by the permission shadow */
+#define SDP_SHADOW_DEVICES	16
+
+/**
+ * struct sdp_chunk - contiguous part of a region
+ *
+ * @chunk_node: node in the client tree, each chunk of a region is indexed
+ * @addr: DMA address
+ * @size: size
+ * @__subtree_last: interval tree bookkeeping
+ * @region: the region the chunk belongs to
+ */
+struct sdp_chunk {
+	struct rb_node chunk_node;
+	dma_addr_t addr;
+	size_t size;
+	dma_addr_t __subtree_last;
+	struct sdp_region *region;
+};
+
+/* a range of DMA addresses */
+struct sdp_range {
 	dma_addr_t addr;
 	size_t size;
+};
+
+struct sdp_region {
+	/* memory of the region, points to chunk unless it is scattered */
+	struct sdp_chunk *chunks;
+	unsigned int nr_chunks;
+	struct sdp_chunk chunk;
+	/* pool of the region, NULL if the region goes with its client */
+	struct sdp_pool *pool;
+	struct list_head pool_node;
+	/* ranges merged into chunk by address order, NULL if not coalesced */
+	struct sdp_range *members;
+	unsigned int nr_members;
 	int id;
+	/* one reference for the client tree and one per lookup */
+	struct kref ref;
+	struct rcu_head rcu;
+	/* serialize permission updates, keeps the shadow in sync with the TA */
+	struct mutex lock;
+	/* granted direction + 1 per device handle, 0 if not granted */
+	u8 shadow[SDP_SHADOW_DEVICES];
+	/* a device with a handle out of the shadow has access */
+	bool shadow_untracked;
+	/* a queued update failed, the shadow is read back from the TA */
+	bool shadow_unknown;
+	unsigned int shadow_gen;
 };
 
-static struct smaf_optee_device so_dev;
+#define SDP_CHUNK_START(c)	((c)->addr)
+#define SDP_CHUNK_LAST(c)	((c)->addr + (c)->size - 1)
 
-/* trusted application call */
+INTERVAL_TREE_DEFINE(struct sdp_chunk, chunk_node, dma_addr_t,
+		     __subtree_last, SDP_CHUNK_START, SDP_CHUNK_LAST,
+		     static, sdp_chunk_tree)
+
+/* region of the first chunk from node which is the first of its region */
+static struct sdp_region *sdp_next_region(struct rb_node *node)
+{
+	struct sdp_chunk *chunk;
+
+	for (; node; node = rb_next(node)) {
+		chunk = rb_entry(node, struct sdp_chunk, chunk_node);
+		if (chunk == chunk->region->chunks)
+			return chunk->region;
+	}
+
+	return NULL;
+}
+
+#define sdp_first_region(client) \
+	sdp_next_region(rb_first(&(client)->regions))
+
+#define sdp_for_each_region(region, client) \
+	for (region = sdp_first_region(client); region; \
+	     region = sdp_next_region(rb_next(&region->chunks->chunk_node)))
+
+/*
+ * Bound of the lockless tree walk, a walk racing with a tree update may not
+ * end by itself. A longer walk is done again under the client lock.
+ */
+#define SDP_FIND_MAX_LOCKLESS	16
+
+/* kind of match for sdp_region_find() */
+enum sdp_find_mode {
+	SDP_FIND_EXACT,		/* same address and size */
+	SDP_FIND_CONTAINING,	/* region covers the whole range */
+	SDP_FIND_OVERLAP,	/* region intersects the range */
+	SDP_FIND_FIRST_CHUNK,	/* first chunk has the same address and size */
+};
+
+/**
+ * struct sdp_revoke - revocation waiting to be sent to the TA
+ *
+ * @revoke_node: node in the client revokes list
+ * @region: the region, a reference is held until the revocation is done
+ * @handle: device handle
+ * @dir: access direction
+ */
+struct sdp_revoke {
+	struct list_head revoke_node;
+	struct sdp_region *region;
+	uint32_t handle;
+	enum dma_data_direction dir;
+};
 
 /**
- * sdp_ta_create_region -create a region with a given address and size
+ * struct sdp_batch - operations accumulated to be sent in one TA call
+ *
+ * @entries: operations array shared with the TA
+ * @count: number of operations queued
+ * @max: capacity of @entries
+ */
+struct sdp_batch {
+	struct sdp_batch_entry *entries;
+	unsigned int count;
+	unsigned int max;
+};
+
+static struct smaf_optee_device so_dev;
+
+#define SDP_MAX_SESSIONS	BITS_PER_LONG
+#define SDP_SESSIONS_MASK	(~0UL >> (BITS_PER_LONG - so_dev.nr_sessions))
+
+static unsigned int nr_sessions;
+module_param(nr_sessions, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_sessions,
+		 "Number of TEE sessions used in parallel (default: one per CPU)");
+
+#define SDP_MAX_RING_SIZE	4096
+
+static unsigned int ring_size;
+module_param(ring_size, uint, S_IRUGO);
+MODULE_PARM_DESC(ring_size,
+		 "Entries of the asynchronous command ring (default: 0, disabled)");
+
+static bool coalesce;
+module_param(coalesce, bool, S_IRUGO);
+MODULE_PARM_DESC(coalesce,
+		 "Merge adjacent regions with the same permissions (default: false)");
+
+static bool deferred_revoke;
+module_param(deferred_revoke, bool, S_IRUGO);
+MODULE_PARM_DESC(deferred_revoke,
+		 "Queue revocations and send them in batches (default: false)");
+
+#define SDP_MAX_TRACE_SIZE	(1 << 20)
+
+static unsigned int trace_size;
+module_param(trace_size, uint, S_IRUGO);
+MODULE_PARM_DESC(trace_size,
+		 "Entries of the operations trace (default: 0, disabled)");
+
+static bool replay_realtime;
+module_param(replay_realtime, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(replay_realtime,
+		 "Replay traces at their original pace (default: false, as fast as possible)");
+
+/* deferred revocations are sent after this delay or when there are enough */
+#define SDP_REVOKE_DELAY_MS	10
+#define SDP_REVOKE_BATCH	32
+
+/* sessions pool */
+
+/*
+ * Borrow a free session, starting from the one of the current CPU so that
+ * callers on different CPUs don't compete for the same session.
  *
- * in case of success return a region id (>=0) else -EINVAL
+ * The pool only spares the callers from waiting for each other on the
+ * normal world side: the TA is a single instance (TA_FLAG_SINGLE_INSTANCE),
+ * so OP-TEE still runs the commands of all the sessions one at a time.
+ */
+static TEEC_Session *sdp_session_get(void)
+{
+	unsigned int i, start;
+
+	start = raw_smp_processor_id() % so_dev.nr_sessions;
+
+	for (;;) {
+		for (i = 0; i < so_dev.nr_sessions; i++) {
+			unsigned int index = (start + i) % so_dev.nr_sessions;
+
+			if (!test_and_set_bit_lock(index, &so_dev.sessions_busy))
+				return &so_dev.sessions[index];
+		}
+
+		atomic64_inc(&so_dev.sessions_waits);
+		wait_event(so_dev.sessions_wq,
+			   (READ_ONCE(so_dev.sessions_busy) & SDP_SESSIONS_MASK)
+			   != SDP_SESSIONS_MASK);
+	}
+}
+
+static void sdp_session_put(TEEC_Session *session)
+{
+	clear_bit_unlock(session - so_dev.sessions, &so_dev.sessions_busy);
+	smp_mb__after_atomic();
+	wake_up(&so_dev.sessions_wq);
+}
+
+static void sdp_stats_record(uint32_t cmd, ktime_t start, TEEC_Result res,
+			     uint32_t ta_us)
+{
+	struct sdp_cmd_stats *stats;
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned int bucket;
+
+	if (cmd >= SDP_NR_COMMANDS)
+		return;
+
+	stats = &so_dev.stats[cmd];
+
+	bucket = ns > 0 ? ilog2(ns) : 0;
+	if (bucket >= SDP_LATENCY_BUCKETS)
+		bucket = SDP_LATENCY_BUCKETS - 1;
+
+	atomic64_inc(&stats->calls);
+	atomic64_add(ns, &stats->total_ns);
+	atomic64_add((u64)ta_us * NSEC_PER_USEC, &stats->ta_ns);
+	atomic64_inc(&stats->latency[bucket]);
+	if (res != TEEC_SUCCESS)
+		atomic64_inc(&stats->errors);
+}
+
+static void sdp_stats_reset(void)
+{
+	struct sdp_cmd_stats *stats;
+	int i, j;
+
+	for (i = 0; i < SDP_NR_COMMANDS; i++) {
+		stats = &so_dev.stats[i];
+		atomic64_set(&stats->calls, 0);
+		atomic64_set(&stats->errors, 0);
+		atomic64_set(&stats->total_ns, 0);
+		atomic64_set(&stats->ta_ns, 0);
+		for (j = 0; j < SDP_LATENCY_BUCKETS; j++)
+			atomic64_set(&stats->latency[j], 0);
+	}
+
+	so_dev.stats_reset = ktime_get();
+}
+
+/* operations tracer */
+static int sdp_trace_init(void)
+{
+	unsigned int size;
+
+	if (!trace_size)
+		return 0;
+
+	size = roundup_pow_of_two(min_t(unsigned int, trace_size,
+					SDP_MAX_TRACE_SIZE));
+
+	so_dev.trace = vzalloc(size * sizeof(*so_dev.trace));
+	if (!so_dev.trace)
+		return -ENOMEM;
+
+	so_dev.trace_mask = size - 1;
+	atomic64_set(&so_dev.trace_head, 0);
+
+	return 0;
+}
+
+static void sdp_trace_release(void)
+{
+	vfree(so_dev.trace);
+	so_dev.trace = NULL;
+}
+
+/*
+ * Record an operation, the oldest entries are overwritten when the ring is
+ * full. Writers don't wait for each other or for readers, so a reader racing
+ * with a wrap around may see a partly updated entry.
+ */
+static void sdp_trace_record(enum sdp_trace_op op, struct sdp_client *client,
+			     const char *device, dma_addr_t addr, size_t size,
+			     enum dma_data_direction dir, bool failed)
+{
+	struct sdp_trace_entry *entry;
+	u64 index;
+
+	if (!so_dev.trace)
+		return;
+
+	index = atomic64_inc_return(&so_dev.trace_head) - 1;
+	entry = &so_dev.trace[index & so_dev.trace_mask];
+
+	entry->time_ns = ktime_get_ns();
+	entry->addr = addr;
+	entry->size = size;
+	entry->client = client->id;
+	entry->op = op;
+	entry->dir = dir;
+	entry->failed = failed;
+	entry->reserved = 0;
+	if (device)
+		strlcpy(entry->device, device, sizeof(entry->device));
+	else
+		entry->device[0] = '\0';
+}
+
+/* call the TA on any free session, without ordering against the ring */
+static TEEC_Result __sdp_invoke(uint32_t cmd, TEEC_Operation *op,
+				uint32_t *err_origin)
+{
+	TEEC_Session *session;
+	TEEC_Result res;
+	uint32_t ta_us = 0;
+	bool timed;
+	ktime_t start;
+
+	/* ask the TA for the time it spends, when the parameter is free */
+	timed = SDP_PARAM_TYPE_GET(op->paramTypes, 3) == TEEC_NONE;
+	if (timed) {
+		op->paramTypes |= TEEC_PARAM_TYPES(0, 0, 0, TEEC_VALUE_OUTPUT);
+		op->params[3].value.a = 0;
+	}
+
+	session = sdp_session_get();
+
+	start = ktime_get();
+	res = TEEC_InvokeCommand(session, cmd, op, err_origin);
+	if (timed && res == TEEC_SUCCESS)
+		ta_us = op->params[3].value.a;
+	sdp_stats_record(cmd, start, res, ta_us);
+
+	sdp_session_put(session);
+
+	return res;
+}
+
+/* regions */
+
+static void sdp_region_free(struct sdp_region *region)
+{
+	if (region->chunks != &region->chunk)
+		kfree(region->chunks);
+	kfree(region->members);
+	kfree(region);
+}
+
+/* lockless lookups may still walk the chunks */
+static void sdp_region_free_rcu(struct rcu_head *rcu)
+{
+	sdp_region_free(container_of(rcu, struct sdp_region, rcu));
+}
+
+static void sdp_region_release(struct kref *ref)
+{
+	struct sdp_region *region = container_of(ref, struct sdp_region, ref);
+
+	call_rcu(&region->rcu, sdp_region_free_rcu);
+}
+
+static void sdp_region_put(struct sdp_region *region)
+{
+	kref_put(&region->ref, sdp_region_release);
+}
+
+/* asynchronous command ring */
+
+/*
+ * Let the TA process all the queued entries and reap their completions.
+ * Only revocations are queued: a failure means the shadow of the region
+ * can't be trusted anymore.
+ */
+static void sdp_ring_drain(void)
+{
+	struct sdp_ring *ring = so_dev.ring_shm.buffer;
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin, head;
+
+	mutex_lock(&so_dev.ring_drain_lock);
+
+	while (READ_ONCE(ring->tail) != so_dev.ring_reap) {
+		memset(&op, 0, sizeof(op));
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_WHOLE, TEEC_NONE,
+						 TEEC_NONE, TEEC_NONE);
+		op.params[0].memref.parent = &so_dev.ring_shm;
+
+		res = __sdp_invoke(TA_SDP_RING_DRAIN, &op, &err_origin);
+
+		if (res != TEEC_SUCCESS) {
+			printk(KERN_ERR "failed to drain ring 0x%x 0x%x\n",
+			       res, err_origin);
+			break;
+		}
+
+		head = READ_ONCE(ring->head);
+		for (; so_dev.ring_reap != head; so_dev.ring_reap++) {
+			uint32_t index = so_dev.ring_reap & (ring->size - 1);
+			struct sdp_batch_entry *entry = &ring->entries[index];
+			struct sdp_region *region = so_dev.ring_regions[index];
+
+			so_dev.ring_regions[index] = NULL;
+
+			if (entry->status != TEEC_SUCCESS) {
+				printk(KERN_ERR "failed to update region %d 0x%x\n",
+				       entry->id, entry->status);
+				atomic64_inc(&so_dev.ring_errors);
+				WRITE_ONCE(region->shadow_unknown, true);
+			}
+
+			sdp_region_put(region);
+		}
+	}
+
+	mutex_unlock(&so_dev.ring_drain_lock);
+}
+
+static void sdp_ring_work(struct work_struct *work)
+{
+	if (READ_ONCE(so_dev.ring))
+		sdp_ring_drain();
+}
+
+/*
+ * Complete all queued entries before a synchronous call, so that the TA
+ * sees the operations in the order they were requested.
+ */
+static void sdp_ring_sync(void)
+{
+	if (so_dev.ring &&
+	    READ_ONCE(so_dev.ring->tail) != READ_ONCE(so_dev.ring_reap))
+		sdp_ring_drain();
+}
+
+/*
+ * return 0 if the entry is queued, it is completed asynchronously and holds
+ * a reference to its region until then
  */
-static int sdp_ta_region_create(dma_addr_t addr, size_t size)
+static int sdp_ring_queue(struct sdp_batch_entry *entry,
+			  struct sdp_region *region)
+{
+	struct sdp_ring *ring = so_dev.ring;
+	uint32_t tail;
+
+	if (!ring)
+		return -ENODEV;
+
+	spin_lock(&so_dev.ring_lock);
+
+	tail = ring->tail;
+	if (tail - READ_ONCE(so_dev.ring_reap) >= ring->size) {
+		spin_unlock(&so_dev.ring_lock);
+		return -EBUSY;
+	}
+
+	ring->entries[tail & (ring->size - 1)] = *entry;
+	kref_get(&region->ref);
+	so_dev.ring_regions[tail & (ring->size - 1)] = region;
+	/* the entry must be visible before the TA can see the new tail */
+	smp_wmb();
+	WRITE_ONCE(ring->tail, tail + 1);
+
+	spin_unlock(&so_dev.ring_lock);
+
+	queue_work(system_wq, &so_dev.ring_work);
+
+	return 0;
+}
+
+static int sdp_ring_init(void)
+{
+	unsigned int size;
+	TEEC_Result res;
+
+	if (!ring_size)
+		return 0;
+
+	size = roundup_pow_of_two(min_t(unsigned int, ring_size,
+					SDP_MAX_RING_SIZE));
+
+	so_dev.ring_regions = kcalloc(size, sizeof(*so_dev.ring_regions),
+				      GFP_KERNEL);
+	if (!so_dev.ring_regions)
+		return -ENOMEM;
+
+	memset(&so_dev.ring_shm, 0, sizeof(so_dev.ring_shm));
+	so_dev.ring_shm.size = sizeof(struct sdp_ring) +
+			       size * sizeof(struct sdp_batch_entry);
+	so_dev.ring_shm.flags = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+
+	res = TEEC_AllocateSharedMemory(&so_dev.ctx, &so_dev.ring_shm);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to allocate ring 0x%x\n", res);
+		kfree(so_dev.ring_regions);
+		so_dev.ring_regions = NULL;
+		return -ENOMEM;
+	}
+
+	memset(so_dev.ring_shm.buffer, 0, so_dev.ring_shm.size);
+	so_dev.ring_reap = 0;
+	so_dev.ring = so_dev.ring_shm.buffer;
+	so_dev.ring->size = size;
+
+	return 0;
+}
+
+static void sdp_ring_release(void)
+{
+	struct sdp_ring *ring = so_dev.ring;
+	struct sdp_region *region;
+	uint32_t i;
+
+	if (!ring)
+		return;
+
+	/* stop queueing, then complete what is already queued */
+	WRITE_ONCE(so_dev.ring, NULL);
+	cancel_work_sync(&so_dev.ring_work);
+	sdp_ring_drain();
+
+	/* the entries the TA could not drain are lost */
+	for (i = 0; i < ring->size; i++) {
+		region = so_dev.ring_regions[i];
+		if (!region)
+			continue;
+		WRITE_ONCE(region->shadow_unknown, true);
+		sdp_region_put(region);
+	}
+	kfree(so_dev.ring_regions);
+	so_dev.ring_regions = NULL;
+
+	TEEC_ReleaseSharedMemory(&so_dev.ring_shm);
+}
+
+static TEEC_Result sdp_invoke(uint32_t cmd, TEEC_Operation *op,
+			      uint32_t *err_origin)
+{
+	sdp_ring_sync();
+
+	return __sdp_invoke(cmd, op, err_origin);
+}
+
+/* trusted application call */
+
+static int sdp_ta_region_destroy(int region_id)
 {
 	TEEC_Operation op;
 	TEEC_Result res;
@@ -66,316 +872,3059 @@ static int sdp_ta_region_create(dma_addr_t addr, size_t size)
 
 	memset(&op, 0, sizeof(op));
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_VALUE_INPUT,
-					 TEEC_VALUE_OUTPUT, TEEC_NONE);
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
 
-#ifdef CONFIG_ARCH_DMA_ADDR_T_64BIT
-#error "not implemented"
-#else
-	op.params[0].value.a = 0x0;
-	op.params[0].value.b = addr;
-#endif
-	op.params[1].value.a = size;
+	op.params[0].value.a = region_id;
 
-	res = TEEC_InvokeCommand(&so_dev.session, TA_SDP_CREATE_REGION,
-				 &op, &err_origin);
+	res = sdp_invoke(TA_SDP_DESTROY_REGION, &op, &err_origin);
 	if (res != TEEC_SUCCESS) {
-		printk(KERN_ERR "failed to create region 0x%x 0x%x\n",
+		printk(KERN_ERR "failed to destroy region 0x%x 0x%x\n",
 		       res, err_origin);
 		return -EINVAL;
 	}
 
-	return op.params[2].value.a;
+	return 0;
+}
+
+static int sdp_ta_region_update(struct sdp_region *region, uint32_t handle,
+				enum dma_data_direction dir, bool add)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_NONE);
+
+	op.params[0].value.a = region->id;
+	op.params[0].value.b = add;
+	op.params[1].value.a = handle;
+	op.params[2].value.a = dir;
+
+	res = sdp_invoke(TA_SDP_UPDATE_REGION, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to update region 0x%x 0x%x\n",
+		       res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* get the devices which can read and write the region, bit n for handle n */
+static int sdp_ta_region_access(struct sdp_region *region, u32 *readers,
+				u32 *writers)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE);
+
+	op.params[0].value.a = upper_32_bits(region->chunks[0].addr);
+	op.params[0].value.b = lower_32_bits(region->chunks[0].addr);
+
+	res = sdp_invoke(TA_SDP_LOOKUP_ADDR, &op, &err_origin);
+	if (res != TEEC_SUCCESS || op.params[1].value.a != region->id) {
+		printk(KERN_ERR "failed to look up region %d 0x%x 0x%x\n",
+		       region->id, res, err_origin);
+		return -EINVAL;
+	}
+
+	*readers = op.params[2].value.a;
+	*writers = op.params[2].value.b;
+
+	return 0;
+}
+
+/* create a scattered region, the TA gives the region identifier */
+static int sdp_ta_region_create_sg(struct sdp_region *region, uint32_t owner,
+				   uint32_t handle,
+				   enum dma_data_direction dir)
+{
+	struct sdp_sg_entry *entries;
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+	unsigned int i;
+
+	entries = kcalloc(region->nr_chunks, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	for (i = 0; i < region->nr_chunks; i++) {
+		entries[i].addr_msb = upper_32_bits(region->chunks[i].addr);
+		entries[i].addr_lsb = lower_32_bits(region->chunks[i].addr);
+		entries[i].size_msb = upper_32_bits(region->chunks[i].size);
+		entries[i].size_lsb = lower_32_bits(region->chunks[i].size);
+	}
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INOUT,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = entries;
+	op.params[0].tmpref.size = region->nr_chunks * sizeof(*entries);
+	op.params[1].value.a = handle;
+	op.params[1].value.b = dir;
+	op.params[2].value.b = owner;
+
+	res = sdp_invoke(TA_SDP_CREATE_REGION_SG, &op, &err_origin);
+	kfree(entries);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to create region 0x%x 0x%x\n",
+		       res, err_origin);
+		return -EINVAL;
+	}
+
+	region->id = op.params[2].value.a;
+
+	return 0;
+}
+
+static int sdp_ta_region_resize(struct sdp_region *region, dma_addr_t addr,
+				size_t size)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_NONE);
+
+	op.params[0].value.a = region->id;
+	op.params[1].value.a = upper_32_bits(addr);
+	op.params[1].value.b = lower_32_bits(addr);
+	op.params[2].value.a = upper_32_bits(size);
+	op.params[2].value.b = lower_32_bits(size);
+
+	res = sdp_invoke(TA_SDP_RESIZE_REGION, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to resize region 0x%x 0x%x\n",
+		       res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sdp_ta_pipeline_register(unsigned int pipeline,
+				    struct sdp_pipeline_stage *stages,
+				    unsigned int count)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = stages;
+	op.params[0].tmpref.size = count * sizeof(*stages);
+	op.params[1].value.a = pipeline;
+
+	res = sdp_invoke(TA_SDP_REGISTER_PIPELINE, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to register pipeline 0x%x 0x%x\n",
+		       res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sdp_ta_pipeline_apply(struct sdp_region *region,
+				 unsigned int pipeline)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].value.a = region->id;
+	op.params[0].value.b = pipeline;
+
+	res = sdp_invoke(TA_SDP_APPLY_PIPELINE, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to apply pipeline 0x%x 0x%x\n",
+		       res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sdp_ta_pool(uint32_t action, unsigned int pool, uint32_t value,
+		       uint32_t *gen)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE);
+
+	op.params[0].value.a = action;
+	op.params[0].value.b = pool;
+	op.params[1].value.a = value;
+
+	res = sdp_invoke(TA_SDP_POOL, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed pool operation %d 0x%x 0x%x\n",
+		       action, res, err_origin);
+		/* out of pools or the pool is full */
+		return res == TEEC_ERROR_OUT_OF_MEMORY ? -ENOSPC : -EINVAL;
+	}
+
+	if (gen)
+		*gen = op.params[2].value.a;
+
+	return 0;
+}
+
+/* destroy all the regions created by the owner, in one call */
+static int sdp_ta_destroy_all(uint32_t owner)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	op.params[0].value.a = owner;
+
+	res = sdp_invoke(TA_SDP_DESTROY_ALL, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to destroy regions of %d 0x%x 0x%x\n",
+		       owner, res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sdp_ta_resolve_device(const char *name, uint32_t *handle)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void *)name;
+	op.params[0].tmpref.size = strlen(name) + 1;
+
+	res = sdp_invoke(TA_SDP_RESOLVE_DEVICE, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to resolve device %s 0x%x 0x%x\n",
+		       name, res, err_origin);
+		return -EINVAL;
+	}
+
+	*handle = op.params[1].value.a;
+
+	return 0;
+}
+
+/* batched trusted application calls */
+static int sdp_batch_init(struct sdp_batch *batch, unsigned int max)
+{
+	batch->entries = kcalloc(max, sizeof(*batch->entries), GFP_KERNEL);
+	if (!batch->entries)
+		return -ENOMEM;
+
+	batch->count = 0;
+	batch->max = max;
+
+	return 0;
+}
+
+static void sdp_batch_release(struct sdp_batch *batch)
+{
+	kfree(batch->entries);
+	batch->entries = NULL;
+	batch->count = 0;
+	batch->max = 0;
+}
+
+static struct sdp_batch_entry *sdp_batch_next(struct sdp_batch *batch,
+					      uint32_t cmd)
+{
+	struct sdp_batch_entry *entry;
+
+	if (batch->count >= batch->max)
+		return NULL;
+
+	entry = &batch->entries[batch->count++];
+	memset(entry, 0, sizeof(*entry));
+	entry->cmd = cmd;
+
+	return entry;
+}
+
+/**
+ * sdp_batch_add_create - queue the creation of a region owned by a client
+ *
+ * return the index of the entry, to be used with SDP_BATCH_ID_REF by the
+ * following entries of the batch, or a negative value if the batch is full
+ */
+static int sdp_batch_add_create(struct sdp_batch *batch, uint32_t owner,
+				dma_addr_t addr, size_t size)
+{
+	struct sdp_batch_entry *entry;
+
+	entry = sdp_batch_next(batch, TA_SDP_CREATE_REGION);
+	if (!entry)
+		return -ENOSPC;
+
+	entry->owner = owner;
+	entry->addr_msb = upper_32_bits(addr);
+	entry->addr_lsb = lower_32_bits(addr);
+	entry->size_msb = upper_32_bits(size);
+	entry->size_lsb = lower_32_bits(size);
+
+	return batch->count - 1;
+}
+
+static int sdp_batch_add_resize(struct sdp_batch *batch, uint32_t id,
+				dma_addr_t addr, size_t size)
+{
+	struct sdp_batch_entry *entry;
+
+	entry = sdp_batch_next(batch, TA_SDP_RESIZE_REGION);
+	if (!entry)
+		return -ENOSPC;
+
+	entry->id = id;
+	entry->addr_msb = upper_32_bits(addr);
+	entry->addr_lsb = lower_32_bits(addr);
+	entry->size_msb = upper_32_bits(size);
+	entry->size_lsb = lower_32_bits(size);
+
+	return batch->count - 1;
+}
+
+static int sdp_batch_add_apply(struct sdp_batch *batch, uint32_t id,
+			       unsigned int pipeline)
+{
+	struct sdp_batch_entry *entry;
+
+	entry = sdp_batch_next(batch, TA_SDP_APPLY_PIPELINE);
+	if (!entry)
+		return -ENOSPC;
+
+	entry->id = id;
+	entry->device = pipeline;
+
+	return batch->count - 1;
+}
+
+static int sdp_batch_add_destroy(struct sdp_batch *batch, uint32_t id)
+{
+	struct sdp_batch_entry *entry;
+
+	entry = sdp_batch_next(batch, TA_SDP_DESTROY_REGION);
+	if (!entry)
+		return -ENOSPC;
+
+	entry->id = id;
+
+	return batch->count - 1;
+}
+
+static int sdp_batch_add_update(struct sdp_batch *batch, uint32_t id,
+				uint32_t handle,
+				enum dma_data_direction dir, bool add)
+{
+	struct sdp_batch_entry *entry;
+
+	entry = sdp_batch_next(batch, TA_SDP_UPDATE_REGION);
+	if (!entry)
+		return -ENOSPC;
+
+	entry->id = id;
+	entry->add = add;
+	entry->dir = dir;
+	entry->device = handle;
+
+	return batch->count - 1;
+}
+
+/**
+ * sdp_batch_submit - send all queued operations to the TA in one call
+ *
+ * per operation status is available in batch->entries[].status
+ */
+static int sdp_batch_submit(struct sdp_batch *batch)
+{
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	if (!batch->count)
+		return 0;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INOUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = batch->entries;
+	op.params[0].tmpref.size = batch->count * sizeof(*batch->entries);
+	op.params[1].value.a = batch->count;
+
+	res = sdp_invoke(TA_SDP_BATCH, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to submit batch 0x%x 0x%x\n",
+		       res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int __sdp_init_session(void)
+{
+	TEEC_Result res;
+	uint32_t err_origin;
+	TEEC_UUID uuid = TA_SDP_UUID;
+	unsigned int i, count;
+	int ret = -EINVAL;
+	ktime_t start;
+
+	if (smp_load_acquire(&so_dev.session_initialized))
+		return 0;
+
+	mutex_lock(&so_dev.session_lock);
+
+	if (so_dev.session_initialized) {
+		mutex_unlock(&so_dev.session_lock);
+		return 0;
+	}
+
+	count = nr_sessions ? nr_sessions : num_online_cpus();
+	count = clamp_t(unsigned int, count, 1, SDP_MAX_SESSIONS);
+
+	so_dev.sessions = kcalloc(count, sizeof(*so_dev.sessions), GFP_KERNEL);
+	if (!so_dev.sessions) {
+		mutex_unlock(&so_dev.session_lock);
+		return -ENOMEM;
+	}
+
+	start = ktime_get();
+	res = TEEC_InitializeContext(NULL, &so_dev.ctx);
+	if (res != TEEC_SUCCESS) {
+		printk (KERN_ERR "TEEC_InitializeContext failed %d\n", res);
+		goto free_sessions;
+	}
+	so_dev.startup.context_us = ktime_us_delta(ktime_get(), start);
+
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		res = TEEC_OpenSession(&so_dev.ctx, &so_dev.sessions[i], &uuid,
+				TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
+		if (res != TEEC_SUCCESS) {
+			printk(KERN_ERR "TEEC_OpenSession failed %d\n", res);
+			goto close_sessions;
+		}
+	}
+
+	so_dev.startup.sessions_us = ktime_us_delta(ktime_get(), start);
+	so_dev.nr_sessions = count;
+	so_dev.sessions_busy = 0;
+
+	/* the ring is optional, go on without it */
+	sdp_ring_init();
+
+	smp_store_release(&so_dev.session_initialized, true);
+	mutex_unlock(&so_dev.session_lock);
+	return 0;
+
+close_sessions:
+	while (i--)
+		TEEC_CloseSession(&so_dev.sessions[i]);
+	TEEC_FinalizeContext(&so_dev.ctx);
+free_sessions:
+	kfree(so_dev.sessions);
+	so_dev.sessions = NULL;
+	mutex_unlock(&so_dev.session_lock);
+	return ret;
+}
+
+/*
+ * The sessions are opened at load by sdp_init_work(), callers coming before
+ * the end wait for it instead of doing it themselves. They only try again
+ * if it failed.
+ */
+static int sdp_init_session(void)
+{
+	if (smp_load_acquire(&so_dev.session_initialized))
+		return 0;
+
+	wait_for_completion(&so_dev.init_done);
+
+	return __sdp_init_session();
+}
+
+/* a first command, so that the first real one doesn't pay for it */
+static int sdp_warmup(void)
+{
+	struct sdp_ta_stats stats[SDP_NR_COMMANDS];
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t err_origin;
+
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = stats;
+	op.params[0].tmpref.size = sizeof(stats);
+
+	res = sdp_invoke(TA_SDP_GET_STATS, &op, &err_origin);
+	if (res != TEEC_SUCCESS) {
+		printk(KERN_ERR "warm-up failed 0x%x 0x%x\n", res, err_origin);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void sdp_init_work(struct work_struct *work)
+{
+	ktime_t start;
+	int ret;
+
+	ret = __sdp_init_session();
+	if (!ret) {
+		start = ktime_get();
+		ret = sdp_warmup();
+		so_dev.startup.warmup_us = ktime_us_delta(ktime_get(), start);
+	}
+
+	so_dev.startup.total_us = ktime_us_delta(ktime_get(),
+						 so_dev.init_start);
+	so_dev.startup.ret = ret;
+
+	complete_all(&so_dev.init_done);
+}
+
+static void sdp_device_flush(void)
+{
+	struct sdp_device *device;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock(&so_dev.devices_lock);
+	hash_for_each_safe(so_dev.devices, bkt, tmp, device, device_node) {
+		hash_del(&device->device_node);
+		kfree(device);
+	}
+	spin_unlock(&so_dev.devices_lock);
+}
+
+static void sdp_destroy_session(void)
+{
+	unsigned int i;
+
+	mutex_lock(&so_dev.session_lock);
+
+	if (!so_dev.session_initialized) {
+		mutex_unlock(&so_dev.session_lock);
+		return;
+	}
+
+	sdp_device_flush();
+	sdp_ring_release();
+
+	for (i = 0; i < so_dev.nr_sessions; i++)
+		TEEC_CloseSession(&so_dev.sessions[i]);
+	TEEC_FinalizeContext(&so_dev.ctx);
+	kfree(so_dev.sessions);
+	so_dev.sessions = NULL;
+	so_dev.nr_sessions = 0;
+	so_dev.session_initialized = false;
+	so_dev.session_gen++;
+
+	mutex_unlock(&so_dev.session_lock);
+}
+
+/* internal functions */
+
+/* name given to the TA to resolve the handle of a device */
+static const char *sdp_device_name(struct device *dev)
+{
+	if (dev->driver)
+		return dev->driver->name;
+
+	return "cpu";
+}
+
+/**
+ * sdp_device_handle - get the TA handle of a device
+ *
+ * handles are resolved by name once and then cached per struct device
+ */
+static int sdp_device_handle(struct device *dev, uint32_t *handle)
+{
+	struct sdp_device *device, *new;
+
+	spin_lock(&so_dev.devices_lock);
+	hash_for_each_possible(so_dev.devices, device, device_node,
+			       (unsigned long)dev) {
+		if (device->dev == dev && device->driver == dev->driver) {
+			*handle = device->handle;
+			spin_unlock(&so_dev.devices_lock);
+			return 0;
+		}
+	}
+	spin_unlock(&so_dev.devices_lock);
+
+	if (sdp_init_session())
+		return -EINVAL;
+
+	if (sdp_ta_resolve_device(sdp_device_name(dev), handle))
+		return -EINVAL;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return 0;
+
+	new->dev = dev;
+	new->driver = dev->driver;
+	new->handle = *handle;
+
+	/* drop a stale entry left by a previous driver of the device */
+	spin_lock(&so_dev.devices_lock);
+	hash_for_each_possible(so_dev.devices, device, device_node,
+			       (unsigned long)dev) {
+		if (device->dev == dev) {
+			hash_del(&device->device_node);
+			kfree(device);
+			break;
+		}
+	}
+	hash_add(so_dev.devices, &new->device_node, (unsigned long)dev);
+	spin_unlock(&so_dev.devices_lock);
+
+	return 0;
+}
+
+/*
+ * The shadow mirrors the access given to devices by the TA on a region, it
+ * is used to answer grant and revoke requests that change nothing without
+ * calling the TA. Must be called with region->lock held.
+ */
+static bool sdp_shadow_check(struct sdp_region *region)
+{
+	if (region->shadow_gen != so_dev.session_gen) {
+		memset(region->shadow, 0, sizeof(region->shadow));
+		region->shadow_untracked = false;
+		region->shadow_gen = so_dev.session_gen;
+		return false;
+	}
+
+	return true;
+}
+
+static bool sdp_shadow_match(struct sdp_region *region, uint32_t handle,
+			     enum dma_data_direction dir, bool add)
+{
+	if (!sdp_shadow_check(region) || READ_ONCE(region->shadow_unknown))
+		return false;
+
+	if (handle >= SDP_SHADOW_DEVICES)
+		return false;
+
+	if (add)
+		return region->shadow[handle] == dir + 1;
+
+	return region->shadow[handle] == 0;
+}
+
+static void sdp_shadow_update(struct sdp_region *region, uint32_t handle,
+			      enum dma_data_direction dir, bool add)
+{
+	if (handle >= SDP_SHADOW_DEVICES) {
+		if (add)
+			region->shadow_untracked = true;
+		return;
+	}
+
+	region->shadow[handle] = add ? dir + 1 : 0;
+}
+
+/* true if only this device has access to the region, with this direction */
+static bool sdp_shadow_is(struct sdp_region *region, uint32_t handle,
+			  enum dma_data_direction dir)
+{
+	int i;
+
+	if (region->shadow_gen != so_dev.session_gen ||
+	    region->shadow_untracked || READ_ONCE(region->shadow_unknown))
+		return false;
+
+	for (i = 0; i < SDP_SHADOW_DEVICES; i++)
+		if (region->shadow[i] != (i == handle ? dir + 1 : 0))
+			return false;
+
+	return true;
+}
+
+/*
+ * rebuild the shadow from the TA once a queued update left it unknown, must
+ * be called with the region lock held. The lookup completes the ring first,
+ * like any synchronous call, so the TA has all the updates of the region.
+ */
+static void sdp_shadow_refresh(struct sdp_region *region)
+{
+	u32 readers, writers, bit;
+	int i;
+
+	if (sdp_ta_region_access(region, &readers, &writers))
+		return;
+
+	for (i = 0; i < SDP_SHADOW_DEVICES; i++) {
+		bit = BIT(i);
+		if (!((readers | writers) & bit))
+			region->shadow[i] = 0;
+		else if (!(writers & bit))
+			region->shadow[i] = DMA_TO_DEVICE + 1;
+		else if (!(readers & bit))
+			region->shadow[i] = DMA_FROM_DEVICE + 1;
+		else
+			region->shadow[i] = DMA_BIDIRECTIONAL + 1;
+	}
+	region->shadow_untracked = (readers | writers) >> SDP_SHADOW_DEVICES;
+	WRITE_ONCE(region->shadow_unknown, false);
+}
+
+/* queue an update in the command ring, return 0 if queued */
+static int sdp_region_update_async(struct sdp_region *region, uint32_t handle,
+				   enum dma_data_direction dir, bool add)
+{
+	struct sdp_batch_entry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.cmd = TA_SDP_UPDATE_REGION;
+	entry.id = region->id;
+	entry.add = add;
+	entry.dir = dir;
+	entry.device = handle;
+
+	return sdp_ring_queue(&entry, region);
+}
+
+/*
+ * With @async the update is queued in the command ring when it is enabled
+ * and not full, errors are then only reported in the logs
+ */
+static int sdp_region_update(struct sdp_region *region, uint32_t handle,
+			     enum dma_data_direction dir, bool add, bool async)
+{
+	int ret = 0;
+
+	mutex_lock(&region->lock);
+
+	if (sdp_shadow_match(region, handle, dir, add)) {
+		atomic64_inc(&so_dev.shadow_hits);
+		goto out;
+	}
+
+	atomic64_inc(&so_dev.shadow_misses);
+
+	if (!async || sdp_region_update_async(region, handle, dir, add)) {
+		ret = sdp_ta_region_update(region, handle, dir, add);
+		if (!ret && READ_ONCE(region->shadow_unknown))
+			sdp_shadow_refresh(region);
+	}
+	if (!ret)
+		sdp_shadow_update(region, handle, dir, add);
+
+out:
+	mutex_unlock(&region->lock);
+	return ret;
+}
+
+static int sdp_region_add(struct sdp_region *region, uint32_t handle,
+			  enum dma_data_direction dir)
+{
+	return sdp_region_update(region, handle, dir, true, false);
+}
+
+static int sdp_region_remove(struct sdp_region *region, uint32_t handle,
+			     enum dma_data_direction dir)
+{
+	return sdp_region_update(region, handle, dir, false, true);
+}
+
+static struct sdp_region *sdp_region_alloc(dma_addr_t addr, size_t size,
+					   int region_id)
+{
+	struct sdp_region *region;
+
+	region = kzalloc(sizeof(*region), GFP_KERNEL);
+	if (!region)
+		return NULL;
+
+	region->chunk.addr = addr;
+	region->chunk.size = size;
+	region->chunk.region = region;
+	region->chunks = &region->chunk;
+	region->nr_chunks = 1;
+	region->id = region_id;
+	kref_init(&region->ref);
+	mutex_init(&region->lock);
+	region->shadow_gen = so_dev.session_gen;
+
+	return region;
+}
+
+static struct sdp_region *sdp_region_alloc_sg(struct sg_table *sgt)
+{
+	struct sdp_region *region;
+	struct scatterlist *sg;
+	int i;
+
+	region = sdp_region_alloc(0, 0, -1);
+	if (!region)
+		return NULL;
+
+	region->chunks = kcalloc(sgt->nents, sizeof(*region->chunks),
+				 GFP_KERNEL);
+	if (!region->chunks) {
+		kfree(region);
+		return NULL;
+	}
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		region->chunks[i].addr = sg_dma_address(sg);
+		region->chunks[i].size = sg_dma_len(sg);
+		region->chunks[i].region = region;
+	}
+	region->nr_chunks = sgt->nents;
+
+	return region;
+}
+
+static void __sdp_region_link(struct sdp_client *client,
+			      struct sdp_region *region)
+{
+	unsigned int i;
+
+	mutex_lock(&client->lock);
+	write_seqcount_begin(&client->regions_seq);
+	for (i = 0; i < region->nr_chunks; i++)
+		sdp_chunk_tree_insert(&region->chunks[i], &client->regions);
+	write_seqcount_end(&client->regions_seq);
+	mutex_unlock(&client->lock);
+}
+
+static void __sdp_region_unlink(struct sdp_client *client,
+				struct sdp_region *region)
+{
+	unsigned int i;
+
+	mutex_lock(&client->lock);
+	write_seqcount_begin(&client->regions_seq);
+	for (i = 0; i < region->nr_chunks; i++)
+		sdp_chunk_tree_remove(&region->chunks[i], &client->regions);
+	write_seqcount_end(&client->regions_seq);
+	mutex_unlock(&client->lock);
+}
+
+/* keep the region in the pool, must be called with pools_lock held */
+static int sdp_pool_add(struct sdp_pool *pool, struct sdp_region *region)
+{
+	int ret;
+
+	ret = sdp_ta_pool(SDP_POOL_ADD, pool->id, region->id, &pool->gen);
+	if (ret)
+		return ret;
+
+	pool->created = true;
+	region->pool = pool;
+	list_add_tail(&region->pool_node, &pool->regions);
+
+	return 0;
+}
+
+/*
+ * insert a new region in the client pool if any, then in the client tree.
+ * If the pool can't take it the region is destroyed: it would otherwise go
+ * away with the context instead of being kept for the next one.
+ */
+static int sdp_region_link(struct sdp_client *client,
+			   struct sdp_region *region)
+{
+	int ret = 0;
+
+	if (!READ_ONCE(client->pool)) {
+		__sdp_region_link(client, region);
+		return 0;
+	}
+
+	mutex_lock(&so_dev.pools_lock);
+	if (client->pool && !region->pool)
+		ret = sdp_pool_add(client->pool, region);
+	if (!ret)
+		__sdp_region_link(client, region);
+	mutex_unlock(&so_dev.pools_lock);
+
+	if (ret) {
+		sdp_ta_region_destroy(region->id);
+		sdp_region_free(region);
+	}
+
+	return ret;
+}
+
+/* change the range of a region made of one chunk */
+static void sdp_region_move(struct sdp_client *client,
+			    struct sdp_region *region,
+			    dma_addr_t addr, size_t size)
+{
+	mutex_lock(&client->lock);
+	write_seqcount_begin(&client->regions_seq);
+	sdp_chunk_tree_remove(&region->chunk, &client->regions);
+	region->chunk.addr = addr;
+	region->chunk.size = size;
+	sdp_chunk_tree_insert(&region->chunk, &client->regions);
+	write_seqcount_end(&client->regions_seq);
+	mutex_unlock(&client->lock);
+}
+
+/*
+ * Create a region and give the device access to it with a single TA call.
+ * The region is kept even if the access can't be granted, like when both
+ * steps are done separately.
+ */
+static int sdp_region_create_granted(struct sdp_client *client,
+				     dma_addr_t addr, size_t size,
+				     uint32_t handle,
+				     enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+	struct sdp_batch batch;
+	int create, err, ret = -EINVAL;
+
+	if (sdp_init_session())
+		return -EINVAL;
+
+	if (sdp_batch_init(&batch, 2))
+		return -ENOMEM;
+
+	create = sdp_batch_add_create(&batch, client->id, addr, size);
+	sdp_batch_add_update(&batch, SDP_BATCH_ID_REF | create, handle, dir,
+			     true);
+
+	if (sdp_batch_submit(&batch))
+		goto out;
+
+	if (batch.entries[0].status != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to create region 0x%x\n",
+		       batch.entries[0].status);
+		goto out;
+	}
+
+	region = sdp_region_alloc(addr, size, batch.entries[0].id);
+	if (!region) {
+		/* don't leave the TA region behind, nothing would destroy it */
+		sdp_ta_region_destroy(batch.entries[0].id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (batch.entries[1].status != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to update region 0x%x\n",
+		       batch.entries[1].status);
+	} else {
+		sdp_shadow_update(region, handle, dir, true);
+		ret = 0;
+	}
+
+	err = sdp_region_link(client, region);
+	if (err)
+		ret = err;
+
+out:
+	sdp_batch_release(&batch);
+	return ret;
+}
+
+/*
+ * Create a scattered region and give the device access to it with a single
+ * TA call, the region isn't created if the access can't be granted.
+ */
+static int sdp_region_create_sg(struct sdp_client *client,
+				struct sg_table *sgt, uint32_t handle,
+				enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+	int ret;
+
+	if (sdp_init_session())
+		return -EINVAL;
+
+	region = sdp_region_alloc_sg(sgt);
+	if (!region)
+		return -ENOMEM;
+
+	ret = sdp_ta_region_create_sg(region, client->id, handle, dir);
+	if (ret) {
+		sdp_region_free(region);
+		return ret;
+	}
+
+	sdp_shadow_update(region, handle, dir, true);
+
+	return sdp_region_link(client, region);
+}
+
+/*
+ * walk at most max chunks of the range, return ERR_PTR(-EAGAIN) if the walk
+ * stops before the end of the range
+ */
+static struct sdp_region *__sdp_region_find(struct sdp_client *client,
+					    dma_addr_t addr, size_t size,
+					    enum sdp_find_mode mode,
+					    unsigned int max)
+{
+	struct sdp_chunk *chunk;
+	struct sdp_region *region;
+	dma_addr_t last = addr + size - 1;
+
+	for (chunk = sdp_chunk_tree_iter_first(&client->regions, addr, last);
+	     chunk;
+	     chunk = sdp_chunk_tree_iter_next(chunk, addr, last)) {
+		if (!max--)
+			return ERR_PTR(-EAGAIN);
+
+		region = chunk->region;
+
+		if (mode == SDP_FIND_OVERLAP)
+			return region;
+
+		if (mode == SDP_FIND_EXACT && region->nr_chunks == 1 &&
+		    chunk->addr == addr && chunk->size == size)
+			return region;
+
+		if (mode == SDP_FIND_CONTAINING &&
+		    chunk->addr <= addr && SDP_CHUNK_LAST(chunk) >= last)
+			return region;
+
+		if (mode == SDP_FIND_FIRST_CHUNK && chunk == region->chunks &&
+		    chunk->addr == addr && chunk->size == size)
+			return region;
+	}
+
+	return NULL;
+}
+
+/**
+ * sdp_region_find - find a region of a client
+ *
+ * The tree is walked under RCU and the walk is done again with client->lock
+ * held only if it raced with an update.
+ *
+ * return the region with a reference to be dropped with sdp_region_put()
+ */
+static struct sdp_region *sdp_region_find(struct sdp_client *client,
+					  dma_addr_t addr, size_t size,
+					  enum sdp_find_mode mode)
+{
+	struct sdp_region *region;
+	unsigned int seq;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&client->regions_seq);
+
+	region = __sdp_region_find(client, addr, size, mode,
+				   SDP_FIND_MAX_LOCKLESS);
+	if (IS_ERR(region))
+		goto locked;
+	if (region && !kref_get_unless_zero(&region->ref))
+		region = NULL;
+
+	if (!read_seqcount_retry(&client->regions_seq, seq)) {
+		rcu_read_unlock();
+		return region;
+	}
+
+	if (region)
+		sdp_region_put(region);
+
+	/* the walk raced with an update or was too long to finish */
+locked:
+	rcu_read_unlock();
+
+	mutex_lock(&client->lock);
+	region = __sdp_region_find(client, addr, size, mode, UINT_MAX);
+	if (region)
+		kref_get(&region->ref);
+	mutex_unlock(&client->lock);
+
+	return region;
+}
+
+static bool sdp_region_match_sg(struct sdp_region *region,
+				struct sg_table *sgt)
+{
+	struct scatterlist *sg;
+	int i;
+
+	if (region->nr_chunks != sgt->nents)
+		return false;
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		if (region->chunks[i].addr != sg_dma_address(sg) ||
+		    region->chunks[i].size != sg_dma_len(sg))
+			return false;
+	}
+
+	return true;
+}
+
+/* find the region made of the same chunks, in the same order */
+static struct sdp_region *sdp_region_find_sg(struct sdp_client *client,
+					     struct sg_table *sgt)
+{
+	struct sdp_region *region;
+
+	region = sdp_region_find(client, sg_dma_address(sgt->sgl),
+				 sg_dma_len(sgt->sgl), SDP_FIND_FIRST_CHUNK);
+
+	if (region && !sdp_region_match_sg(region, sgt)) {
+		sdp_region_put(region);
+		return NULL;
+	}
+
+	return region;
+}
+
+/* deferred revocations */
+
+/**
+ * sdp_revoke_flush - send all queued revocations of a client in one TA call
+ *
+ * revoke_lock is held during the whole flush so that a grant racing with it
+ * waits for the shadow to be up to date
+ */
+static void sdp_revoke_flush(struct sdp_client *client)
+{
+	struct sdp_revoke *revoke, *tmp;
+	struct sdp_batch batch;
+	bool batched;
+	int i = 0;
+
+	mutex_lock(&client->revoke_lock);
+
+	if (list_empty(&client->revokes))
+		goto out;
+
+	batched = !sdp_batch_init(&batch, client->nr_revokes);
+	if (batched) {
+		list_for_each_entry(revoke, &client->revokes, revoke_node)
+			sdp_batch_add_update(&batch, revoke->region->id,
+					     revoke->handle, revoke->dir,
+					     false);
+
+		if (sdp_batch_submit(&batch))
+			batch.count = 0;
+	}
+
+	list_for_each_entry_safe(revoke, tmp, &client->revokes, revoke_node) {
+		struct sdp_region *region = revoke->region;
+
+		if (!batched) {
+			sdp_region_remove(region, revoke->handle, revoke->dir);
+		} else if (i < batch.count &&
+			   batch.entries[i].status == TEEC_SUCCESS) {
+			mutex_lock(&region->lock);
+			sdp_shadow_update(region, revoke->handle, revoke->dir,
+					  false);
+			mutex_unlock(&region->lock);
+		} else {
+			printk(KERN_ERR "failed to revoke access to region %d\n",
+			       region->id);
+		}
+
+		list_del(&revoke->revoke_node);
+		sdp_region_put(region);
+		kfree(revoke);
+		i++;
+	}
+
+	client->nr_revokes = 0;
+
+	if (batched)
+		sdp_batch_release(&batch);
+out:
+	mutex_unlock(&client->revoke_lock);
+}
+
+static void sdp_revoke_work(struct work_struct *work)
+{
+	struct sdp_client *client = container_of(to_delayed_work(work),
+						 struct sdp_client,
+						 revoke_work);
+
+	sdp_revoke_flush(client);
+}
+
+/* queue a revocation, the same one is queued only once */
+static int sdp_revoke_defer(struct sdp_client *client,
+			    struct sdp_region *region, uint32_t handle,
+			    enum dma_data_direction dir)
+{
+	struct sdp_revoke *revoke;
+	bool granted;
+
+	mutex_lock(&client->revoke_lock);
+
+	mutex_lock(&region->lock);
+	granted = !sdp_shadow_match(region, handle, dir, false);
+	mutex_unlock(&region->lock);
+
+	if (!granted) {
+		atomic64_inc(&so_dev.shadow_hits);
+		goto out;
+	}
+
+	list_for_each_entry(revoke, &client->revokes, revoke_node)
+		if (revoke->region == region && revoke->handle == handle)
+			goto out;
+
+	revoke = kzalloc(sizeof(*revoke), GFP_KERNEL);
+	if (!revoke) {
+		mutex_unlock(&client->revoke_lock);
+		return sdp_region_remove(region, handle, dir);
+	}
+
+	kref_get(&region->ref);
+	revoke->region = region;
+	revoke->handle = handle;
+	revoke->dir = dir;
+	list_add_tail(&revoke->revoke_node, &client->revokes);
+
+	if (++client->nr_revokes >= SDP_REVOKE_BATCH)
+		mod_delayed_work(system_wq, &client->revoke_work, 0);
+	else
+		queue_delayed_work(system_wq, &client->revoke_work,
+				   msecs_to_jiffies(SDP_REVOKE_DELAY_MS));
+out:
+	mutex_unlock(&client->revoke_lock);
+	return 0;
+}
+
+/* a grant cancels the queued revocation of the same device */
+static void sdp_revoke_cancel(struct sdp_client *client,
+			      struct sdp_region *region, uint32_t handle)
+{
+	struct sdp_revoke *revoke;
+
+	mutex_lock(&client->revoke_lock);
+
+	list_for_each_entry(revoke, &client->revokes, revoke_node) {
+		if (revoke->region == region && revoke->handle == handle) {
+			list_del(&revoke->revoke_node);
+			client->nr_revokes--;
+			sdp_region_put(region);
+			kfree(revoke);
+			break;
+		}
+	}
+
+	mutex_unlock(&client->revoke_lock);
+}
+
+/* coalescing of adjacent regions */
+
+/* region made of one chunk which ends right before or starts right after */
+static struct sdp_region *sdp_region_neighbour(struct sdp_client *client,
+					       dma_addr_t addr, size_t size)
+{
+	struct sdp_region *region;
+
+	if (addr) {
+		region = sdp_region_find(client, addr - 1, 1, SDP_FIND_OVERLAP);
+		if (region && region->nr_chunks == 1 &&
+		    SDP_CHUNK_LAST(&region->chunk) == addr - 1)
+			return region;
+		if (region)
+			sdp_region_put(region);
+	}
+
+	if (addr + size) {
+		region = sdp_region_find(client, addr + size, 1,
+					 SDP_FIND_OVERLAP);
+		if (region && region->nr_chunks == 1 &&
+		    region->chunk.addr == addr + size)
+			return region;
+		if (region)
+			sdp_region_put(region);
+	}
+
+	return NULL;
+}
+
+/*
+ * must be called with the region lock held: the neighbour found without it
+ * must still border the range, and nothing must have taken the range since
+ */
+static bool sdp_region_still_neighbour(struct sdp_client *client,
+				       struct sdp_region *region,
+				       dma_addr_t addr, size_t size)
+{
+	bool ret;
+
+	if (region->nr_chunks != 1)
+		return false;
+
+	if (SDP_CHUNK_LAST(&region->chunk) != addr - 1 &&
+	    region->chunk.addr != addr + size)
+		return false;
+
+	mutex_lock(&client->lock);
+	ret = !__sdp_region_find(client, addr, size, SDP_FIND_OVERLAP,
+				 UINT_MAX);
+	mutex_unlock(&client->lock);
+
+	return ret;
+}
+
+/* must be called with revoke_lock held */
+static bool sdp_revoke_pending(struct sdp_client *client,
+			       struct sdp_region *region)
+{
+	struct sdp_revoke *revoke;
+
+	list_for_each_entry(revoke, &client->revokes, revoke_node)
+		if (revoke->region == region)
+			return true;
+
+	return false;
+}
+
+/**
+ * sdp_region_coalesce - grant access to a range by extending a neighbour
+ *
+ * The neighbour must give access to this device only, with the same
+ * direction, so that the permissions of the merged region are the ones each
+ * part would have had. The merged ranges are remembered to split the region
+ * again if their permissions diverge.
+ *
+ * return 0 if the range has been merged
+ */
+static int sdp_region_coalesce(struct sdp_client *client,
+			       dma_addr_t addr, size_t size, uint32_t handle,
+			       enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+	struct sdp_range *members;
+	dma_addr_t start;
+	unsigned int n;
+	int ret = -EINVAL;
+
+	if (handle >= SDP_SHADOW_DEVICES)
+		return -EINVAL;
+
+	region = sdp_region_neighbour(client, addr, size);
+	if (!region)
+		return -EINVAL;
+
+	mutex_lock(&client->revoke_lock);
+	mutex_lock(&region->lock);
+
+	/* the neighbour may have been split, resized or joined meanwhile */
+	if (!sdp_region_still_neighbour(client, region, addr, size))
+		goto out;
+
+	if (!sdp_shadow_is(region, handle, dir) ||
+	    sdp_revoke_pending(client, region))
+		goto out;
+
+	/* the region keeps its member list until the TA accepts the merge */
+	n = region->nr_members ? region->nr_members : 1;
+	members = kcalloc(n + 1, sizeof(*members), GFP_KERNEL);
+	if (!members)
+		goto out;
+
+	if (region->members) {
+		memcpy(members, region->members, n * sizeof(*members));
+	} else {
+		members[0].addr = region->chunk.addr;
+		members[0].size = region->chunk.size;
+	}
+
+	if (addr < region->chunk.addr) {
+		memmove(&members[1], &members[0], n * sizeof(*members));
+		members[0].addr = addr;
+		members[0].size = size;
+	} else {
+		members[n].addr = addr;
+		members[n].size = size;
+	}
+
+	start = min(addr, region->chunk.addr);
+	if (sdp_ta_region_resize(region, start, region->chunk.size + size)) {
+		kfree(members);
+		goto out;
+	}
+
+	kfree(region->members);
+	region->members = members;
+	region->nr_members = n + 1;
+
+	sdp_region_move(client, region, start, region->chunk.size + size);
+	atomic64_inc(&so_dev.coalesced);
+	ret = 0;
+
+out:
+	mutex_unlock(&region->lock);
+	mutex_unlock(&client->revoke_lock);
+	sdp_region_put(region);
+	return ret;
+}
+
+/*
+ * true if the range is only a part of a coalesced region, must be called
+ * with region->lock held
+ */
+static bool sdp_region_is_part(struct sdp_region *region, dma_addr_t addr,
+			       size_t size)
+{
+	return region->nr_members &&
+	       (region->chunk.addr != addr || region->chunk.size != size);
+}
+
+/*
+ * true if a coalesced region needs to be split to change the access to a
+ * part of it
+ */
+static bool sdp_region_diverges(struct sdp_region *region,
+				dma_addr_t addr, size_t size,
+				uint32_t handle, enum dma_data_direction dir,
+				bool add)
+{
+	bool ret;
+
+	mutex_lock(&region->lock);
+	ret = sdp_region_is_part(region, addr, size) &&
+	      !sdp_shadow_match(region, handle, dir, add);
+	mutex_unlock(&region->lock);
+
+	return ret;
+}
+
+/**
+ * sdp_region_split - split a coalesced region back into its merged ranges
+ *
+ * The region shrinks to the merged ranges the range intersects and a region
+ * is created for each other one with the same permissions, all in one TA
+ * call. The range is then still contained in the region.
+ */
+static int sdp_region_split(struct sdp_client *client,
+			    struct sdp_region *region,
+			    dma_addr_t addr, size_t size)
+{
+	struct sdp_region *new;
+	struct sdp_batch batch;
+	struct sdp_range *members;
+	unsigned int i, e, h, first, last, granted = 0;
+	int create, ret = -EINVAL;
+
+	/* queued revocations apply to the whole region, send them first */
+	if (deferred_revoke)
+		sdp_revoke_flush(client);
+
+	mutex_lock(&region->lock);
+
+	if (!region->nr_members) {
+		ret = 0;
+		goto unlock;
+	}
+
+	members = region->members;
+
+	/* the region keeps the ranges intersecting the range */
+	for (first = 0; first < region->nr_members - 1; first++)
+		if (members[first].addr + members[first].size > addr)
+			break;
+	for (last = first; last < region->nr_members - 1; last++)
+		if (members[last + 1].addr >= addr + size)
+			break;
+
+	if (!first && last == region->nr_members - 1) {
+		ret = 0;
+		goto unlock;
+	}
+
+	/* a stale shadow is cleared, the new regions get no access then */
+	sdp_shadow_check(region);
+
+	for (h = 0; h < SDP_SHADOW_DEVICES; h++)
+		if (region->shadow[h])
+			granted++;
+
+	if (sdp_batch_init(&batch, 1 + (region->nr_members - 1 -
+					last + first) * (1 + granted))) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	sdp_batch_add_resize(&batch, region->id, members[first].addr,
+			     members[last].addr + members[last].size -
+			     members[first].addr);
+	for (i = 0; i < region->nr_members; i++) {
+		if (i >= first && i <= last)
+			continue;
+
+		create = sdp_batch_add_create(&batch, client->id,
+					      members[i].addr,
+					      members[i].size);
+		for (h = 0; h < SDP_SHADOW_DEVICES; h++)
+			if (region->shadow[h])
+				sdp_batch_add_update(&batch,
+						     SDP_BATCH_ID_REF | create,
+						     h, region->shadow[h] - 1,
+						     true);
+	}
+
+	if (sdp_batch_submit(&batch))
+		goto release;
+
+	if (batch.entries[0].status != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to resize region 0x%x\n",
+		       batch.entries[0].status);
+		goto release;
+	}
+
+	/* each create entry is followed by its updates */
+	for (i = 0, e = 1; i < region->nr_members; i++) {
+		if (i >= first && i <= last)
+			continue;
+
+		new = NULL;
+		if (batch.entries[e].status == TEEC_SUCCESS) {
+			new = sdp_region_alloc(members[i].addr,
+					       members[i].size,
+					       batch.entries[e].id);
+			if (!new)
+				sdp_ta_region_destroy(batch.entries[e].id);
+		} else {
+			printk(KERN_ERR "failed to split region 0x%x\n",
+			       batch.entries[e].status);
+		}
+		e++;
+
+		for (h = 0; h < SDP_SHADOW_DEVICES; h++) {
+			if (!region->shadow[h])
+				continue;
+			if (new && batch.entries[e].status == TEEC_SUCCESS)
+				new->shadow[h] = region->shadow[h];
+			e++;
+		}
+
+		/* like a refused create, the range loses its permissions */
+		if (new)
+			sdp_region_link(client, new);
+	}
+
+	sdp_region_move(client, region, members[first].addr,
+			members[last].addr + members[last].size -
+			members[first].addr);
+	if (first == last) {
+		kfree(region->members);
+		region->members = NULL;
+		region->nr_members = 0;
+	} else {
+		memmove(&members[0], &members[first],
+			(last - first + 1) * sizeof(*members));
+		region->nr_members = last - first + 1;
+	}
+	atomic64_inc(&so_dev.splits);
+	ret = 0;
+
+release:
+	sdp_batch_release(&batch);
+unlock:
+	mutex_unlock(&region->lock);
+	return ret;
+}
+
+/*
+ * find the region containing the range, split first if it is a coalesced
+ * region whose permissions would diverge
+ */
+static struct sdp_region *sdp_region_find_update(struct sdp_client *client,
+						 dma_addr_t addr, size_t size,
+						 uint32_t handle,
+						 enum dma_data_direction dir,
+						 bool add)
+{
+	struct sdp_region *region;
+
+	region = sdp_region_find(client, addr, size, SDP_FIND_CONTAINING);
+
+	if (region && sdp_region_diverges(region, addr, size, handle, dir,
+					  add)) {
+		sdp_region_split(client, region, addr, size);
+		sdp_region_put(region);
+		region = sdp_region_find(client, addr, size,
+					 SDP_FIND_CONTAINING);
+	}
+
+	return region;
+}
+
+/* give access to an existing region, drop the lookup reference */
+static int sdp_region_grant(struct sdp_client *client,
+			    struct sdp_region *region, uint32_t handle,
+			    enum dma_data_direction dir)
+{
+	int ret;
+
+	if (deferred_revoke)
+		sdp_revoke_cancel(client, region, handle);
+
+	ret = sdp_region_add(region, handle, dir);
+	sdp_region_put(region);
+
+	return ret;
+}
+
+/* remove access to a region, drop the lookup reference */
+static int sdp_region_revoke(struct sdp_client *client,
+			     struct sdp_region *region, uint32_t handle,
+			     enum dma_data_direction dir)
+{
+	int ret;
+
+	if (deferred_revoke)
+		ret = sdp_revoke_defer(client, region, handle, dir);
+	else
+		ret = sdp_region_remove(region, handle, dir);
+	sdp_region_put(region);
+
+	return ret;
+}
+
+/* pipelines */
+
+/* must be called with pipelines_lock held */
+static int sdp_pipeline_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < SDP_MAX_PIPELINES; i++)
+		if (!strcmp(so_dev.pipelines[i].name, name))
+			return i;
+
+	return -1;
+}
+
+/*
+ * Register the pipeline in the TA if it isn't yet for the current sessions.
+ * Must be called with pipelines_lock held.
+ */
+static int sdp_pipeline_sync(unsigned int id)
+{
+	struct sdp_pipeline *pipeline = &so_dev.pipelines[id];
+	struct sdp_pipeline_stage stages[SDP_MAX_PIPELINE_STAGES];
+	unsigned int i;
+
+	if (pipeline->registered && pipeline->gen == so_dev.session_gen)
+		return 0;
+
+	for (i = 0; i < pipeline->nr_stages; i++) {
+		if (sdp_device_handle(pipeline->stages[i].dev,
+				      &pipeline->handles[i]))
+			return -EINVAL;
+
+		stages[i].device = pipeline->handles[i];
+		stages[i].dir = pipeline->stages[i].dir;
+	}
+
+	if (sdp_ta_pipeline_register(id, stages, pipeline->nr_stages))
+		return -EINVAL;
+
+	pipeline->registered = true;
+	pipeline->gen = so_dev.session_gen;
+
+	return 0;
+}
+
+/* the devices of the pipeline have been given access to the region */
+static void sdp_pipeline_shadow(struct sdp_region *region,
+				struct sdp_pipeline *pipeline)
+{
+	unsigned int i;
+
+	sdp_shadow_check(region);
+
+	for (i = 0; i < pipeline->nr_stages; i++)
+		sdp_shadow_update(region, pipeline->handles[i],
+				  pipeline->stages[i].dir, true);
+}
+
+/* create a region and apply the pipeline to it with a single TA call */
+static int sdp_region_create_pipeline(struct sdp_client *client,
+				      dma_addr_t addr, size_t size,
+				      unsigned int id,
+				      struct sdp_pipeline *pipeline)
+{
+	struct sdp_region *region;
+	struct sdp_batch batch;
+	int create, err, ret = -EINVAL;
+
+	if (sdp_batch_init(&batch, 2))
+		return -ENOMEM;
+
+	create = sdp_batch_add_create(&batch, client->id, addr, size);
+	sdp_batch_add_apply(&batch, SDP_BATCH_ID_REF | create, id);
+
+	if (sdp_batch_submit(&batch))
+		goto out;
+
+	if (batch.entries[0].status != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to create region 0x%x\n",
+		       batch.entries[0].status);
+		goto out;
+	}
+
+	region = sdp_region_alloc(addr, size, batch.entries[0].id);
+	if (!region) {
+		/* don't leave the TA region behind, nothing would destroy it */
+		sdp_ta_region_destroy(batch.entries[0].id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (batch.entries[1].status != TEEC_SUCCESS) {
+		printk(KERN_ERR "failed to apply pipeline 0x%x\n",
+		       batch.entries[1].status);
+	} else {
+		sdp_pipeline_shadow(region, pipeline);
+		ret = 0;
+	}
+
+	err = sdp_region_link(client, region);
+	if (err)
+		ret = err;
+
+out:
+	sdp_batch_release(&batch);
+	return ret;
+}
+
+/* copy of a pipeline registered in the TA, return its identifier */
+static int sdp_pipeline_get(const char *name, struct sdp_pipeline *pipeline)
+{
+	int id;
+
+	mutex_lock(&so_dev.pipelines_lock);
+	id = sdp_pipeline_find(name);
+	if (id < 0 || sdp_pipeline_sync(id))
+		id = -EINVAL;
+	else
+		*pipeline = so_dev.pipelines[id];
+	mutex_unlock(&so_dev.pipelines_lock);
+
+	return id;
+}
+
+/**
+ * sdp_apply_pipeline - give all the devices of a pipeline access to a range
+ *
+ * All the stages are done by the TA in a single call, on the region
+ * containing the range or on a new one.
+ */
+static int sdp_apply_pipeline(struct sdp_client *client, const char *name,
+			      dma_addr_t addr, size_t size)
+{
+	struct sdp_pipeline pipeline;
+	struct sdp_region *region;
+	unsigned int i;
+	bool part;
+	int id, ret;
+
+	if (!size || sdp_init_session())
+		return -EINVAL;
+
+	id = sdp_pipeline_get(name, &pipeline);
+	if (id < 0)
+		return id;
+
+	region = sdp_region_find(client, addr, size, SDP_FIND_CONTAINING);
+
+	if (region) {
+		mutex_lock(&region->lock);
+		part = sdp_region_is_part(region, addr, size);
+		mutex_unlock(&region->lock);
+	}
+
+	/* the permissions of a part of a coalesced region are changing */
+	if (region && part) {
+		sdp_region_split(client, region, addr, size);
+		sdp_region_put(region);
+		region = sdp_region_find(client, addr, size,
+					 SDP_FIND_CONTAINING);
+	}
+
+	if (!region)
+		return sdp_region_create_pipeline(client, addr, size, id,
+						  &pipeline);
+
+	if (deferred_revoke)
+		for (i = 0; i < pipeline.nr_stages; i++)
+			sdp_revoke_cancel(client, region, pipeline.handles[i]);
+
+	mutex_lock(&region->lock);
+	ret = sdp_ta_pipeline_apply(region, id);
+	if (!ret)
+		sdp_pipeline_shadow(region, &pipeline);
+	mutex_unlock(&region->lock);
+
+	sdp_region_put(region);
+	return ret;
+}
+
+static int sdp_grant_access(struct sdp_client *client, uint32_t handle,
+		     dma_addr_t addr, size_t size, enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+
+	if (!size)
+		return -EINVAL;
+
+	region = sdp_region_find_update(client, addr, size, handle, dir, true);
+
+	if (!region) {
+		if (coalesce &&
+		    !sdp_region_coalesce(client, addr, size, handle, dir))
+			return 0;
+
+		return sdp_region_create_granted(client, addr, size, handle,
+						 dir);
+	}
+
+	return sdp_region_grant(client, region, handle, dir);
+}
+
+static int sdp_revoke_access(struct sdp_client *client, uint32_t handle,
+		     dma_addr_t addr, size_t size, enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+
+	if (!size)
+		return -EINVAL;
+
+	region = sdp_region_find_update(client, addr, size, handle, dir,
+					false);
+
+	if (!region)
+		return -EINVAL;
+
+	return sdp_region_revoke(client, region, handle, dir);
+}
+
+static int sdp_grant_access_sg(struct sdp_client *client, uint32_t handle,
+			       struct sg_table *sgt,
+			       enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+
+	if (!sgt->nents || sgt->nents > SDP_MAX_SG_ENTRIES)
+		return -EINVAL;
+
+	region = sdp_region_find_sg(client, sgt);
+
+	if (!region)
+		return sdp_region_create_sg(client, sgt, handle, dir);
+
+	return sdp_region_grant(client, region, handle, dir);
+}
+
+static int sdp_revoke_access_sg(struct sdp_client *client, uint32_t handle,
+				struct sg_table *sgt,
+				enum dma_data_direction dir)
+{
+	struct sdp_region *region;
+
+	if (!sgt->nents)
+		return -EINVAL;
+
+	region = sdp_region_find_sg(client, sgt);
+
+	if (!region)
+		return -EINVAL;
+
+	return sdp_region_revoke(client, region, handle, dir);
+}
+
+static struct sdp_client *sdp_client_create(void)
+{
+	struct sdp_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return NULL;
+
+	mutex_init(&client->lock);
+	INIT_LIST_HEAD(&client->client_node);
+	client->regions = RB_ROOT;
+	seqcount_mutex_init(&client->regions_seq, &client->lock);
+	INIT_LIST_HEAD(&client->revokes);
+	mutex_init(&client->revoke_lock);
+	INIT_DELAYED_WORK(&client->revoke_work, sdp_revoke_work);
+
+	client->name = kstrdup("smaf-optee", GFP_KERNEL);
+	client->id = atomic_inc_return(&so_dev.client_ids);
+
+	spin_lock(&so_dev.lock);
+	list_add(&client->client_node, &so_dev.clients_head);
+	spin_unlock(&so_dev.lock);
+
+	return client;
+
+}
+
+/* buffer pools */
+
+/* must be called with pools_lock held */
+static struct sdp_pool *sdp_pool_find(unsigned int id)
+{
+	struct sdp_pool *pool;
+
+	list_for_each_entry(pool, &so_dev.pools, pool_node)
+		if (pool->id == id)
+			return pool;
+
+	return NULL;
+}
+
+/**
+ * sdp_pool_attach - make a context use a pool
+ *
+ * The regions of a detached pool are given back to the context as they
+ * were left, with their permissions, the TA only bumps the pool generation.
+ */
+static int sdp_pool_attach(struct sdp_client *client, unsigned int id)
+{
+	struct sdp_region *region;
+	struct sdp_pool *pool;
+	int ret = 0;
+
+	if (sdp_init_session())
+		return -EINVAL;
+
+	mutex_lock(&so_dev.pools_lock);
+
+	pool = sdp_pool_find(id);
+	if (client->pool || (pool && pool->client)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (!pool) {
+		pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+		if (!pool) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		pool->id = id;
+		INIT_LIST_HEAD(&pool->regions);
+		list_add(&pool->pool_node, &so_dev.pools);
+	} else if (pool->created &&
+		   sdp_ta_pool(SDP_POOL_ATTACH, id, pool->gen, &pool->gen)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	list_for_each_entry(region, &pool->regions, pool_node)
+		__sdp_region_link(client, region);
+
+	pool->client = client;
+	client->pool = pool;
+
+out:
+	mutex_unlock(&so_dev.pools_lock);
+	return ret;
+}
+
+/* take the pool regions out of the context, they stay in the TA */
+static void sdp_pool_detach(struct sdp_client *client)
+{
+	struct sdp_region *region;
+	struct sdp_pool *pool;
+
+	mutex_lock(&so_dev.pools_lock);
+
+	pool = client->pool;
+	if (!pool)
+		goto out;
+
+	list_for_each_entry(region, &pool->regions, pool_node)
+		__sdp_region_unlink(client, region);
+
+	if (pool->created)
+		sdp_ta_pool(SDP_POOL_DETACH, pool->id, pool->gen, NULL);
+
+	pool->client = NULL;
+	client->pool = NULL;
+
+out:
+	mutex_unlock(&so_dev.pools_lock);
+}
+
+/* destroy a detached pool, must be called with pools_lock held */
+static int sdp_pool_release(struct sdp_pool *pool)
+{
+	struct sdp_region *region, *tmp;
+	int ret = 0;
+
+	if (pool->client)
+		return -EBUSY;
+
+	/* the regions are forgotten even if the TA failed to destroy them */
+	if (pool->created &&
+	    sdp_ta_pool(SDP_POOL_RELEASE, pool->id, 0, NULL))
+		ret = -EINVAL;
+
+	list_for_each_entry_safe(region, tmp, &pool->regions, pool_node) {
+		list_del(&region->pool_node);
+		sdp_region_put(region);
+	}
+
+	list_del(&pool->pool_node);
+	kfree(pool);
+
+	return ret;
+}
+
+/**
+ * sdp_apply_pipeline_pool - give all the devices of a pipeline access to
+ * the regions of a pool
+ *
+ * All the regions are done by the TA in a single call, each one gets the
+ * access of all the stages or none of them.
+ */
+static int sdp_apply_pipeline_pool(unsigned int pool_id, const char *name)
+{
+	struct sdp_pipeline pipeline;
+	struct sdp_region **regions;
+	struct sdp_region *region;
+	struct sdp_pool *pool;
+	struct sdp_batch batch;
+	unsigned int i, n = 0;
+	bool submitted;
+	int id, ret = 0;
+
+	if (sdp_init_session())
+		return -EINVAL;
+
+	id = sdp_pipeline_get(name, &pipeline);
+	if (id < 0)
+		return id;
+
+	mutex_lock(&so_dev.pools_lock);
+
+	pool = sdp_pool_find(pool_id);
+	if (!pool) {
+		mutex_unlock(&so_dev.pools_lock);
+		return -EINVAL;
+	}
+
+	list_for_each_entry(region, &pool->regions, pool_node)
+		n++;
+
+	if (!n) {
+		mutex_unlock(&so_dev.pools_lock);
+		return 0;
+	}
+
+	regions = kcalloc(n, sizeof(*regions), GFP_KERNEL);
+	if (!regions || sdp_batch_init(&batch, n)) {
+		mutex_unlock(&so_dev.pools_lock);
+		kfree(regions);
+		return -ENOMEM;
+	}
+
+	/* the region locks come before pools_lock, take them once it is out */
+	n = 0;
+	list_for_each_entry(region, &pool->regions, pool_node) {
+		if (deferred_revoke && pool->client)
+			for (i = 0; i < pipeline.nr_stages; i++)
+				sdp_revoke_cancel(pool->client, region,
+						  pipeline.handles[i]);
+
+		kref_get(&region->ref);
+		regions[n++] = region;
+		sdp_batch_add_apply(&batch, region->id, id);
+	}
+
+	mutex_unlock(&so_dev.pools_lock);
+
+	submitted = !sdp_batch_submit(&batch);
+	if (!submitted)
+		ret = -EINVAL;
+
+	for (i = 0; i < n; i++) {
+		region = regions[i];
+
+		if (submitted && batch.entries[i].status == TEEC_SUCCESS) {
+			mutex_lock(&region->lock);
+			sdp_pipeline_shadow(region, &pipeline);
+			mutex_unlock(&region->lock);
+		} else if (submitted) {
+			printk(KERN_ERR "failed to apply pipeline to region %d 0x%x\n",
+			       region->id, batch.entries[i].status);
+			ret = -EINVAL;
+		}
+
+		sdp_region_put(region);
+	}
+
+	sdp_batch_release(&batch);
+	kfree(regions);
+	return ret;
+}
+
+/* destroy the regions of the client by identifier, when the owner failed */
+static void sdp_client_destroy_regions(struct sdp_client *client)
+{
+	struct sdp_region *region;
+	struct sdp_batch batch;
+	unsigned int count = 0;
+
+	mutex_lock(&client->lock);
+
+	sdp_for_each_region(region, client)
+		count++;
+
+	/* all regions in one TA call, one by one as a fallback */
+	if (!sdp_batch_init(&batch, count)) {
+		sdp_for_each_region(region, client)
+			sdp_batch_add_destroy(&batch, region->id);
+
+		if (sdp_batch_submit(&batch))
+			printk(KERN_ERR "failed to destroy %d regions\n", count);
+
+		sdp_batch_release(&batch);
+	} else {
+		sdp_for_each_region(region, client)
+			sdp_ta_region_destroy(region->id);
+	}
+
+	mutex_unlock(&client->lock);
+}
+
+static void sdp_client_destroy(struct sdp_client *client)
+{
+	struct sdp_region *region;
+	struct sdp_chunk *chunk;
+	struct rb_root regions;
+	unsigned int i;
+
+	/* queued revocations hold regions and must reach the TA first */
+	cancel_delayed_work_sync(&client->revoke_work);
+	sdp_revoke_flush(client);
+
+	/* the pool keeps its regions for the next context */
+	sdp_pool_detach(client);
+
+	/* the TA tracks the regions created by the client */
+	if (!RB_EMPTY_ROOT(&client->regions) && sdp_ta_destroy_all(client->id))
+		sdp_client_destroy_regions(client);
+
+	/* take the whole tree out at once, lockless lookups may still walk it */
+	mutex_lock(&client->lock);
+	write_seqcount_begin(&client->regions_seq);
+	regions = client->regions;
+	client->regions = RB_ROOT;
+	write_seqcount_end(&client->regions_seq);
+	mutex_unlock(&client->lock);
+
+	/* a region goes once all its chunks are out, nothing walks them then */
+	while (!RB_EMPTY_ROOT(&regions)) {
+		chunk = rb_entry(regions.rb_node, struct sdp_chunk, chunk_node);
+		region = chunk->region;
+		for (i = 0; i < region->nr_chunks; i++)
+			sdp_chunk_tree_remove(&region->chunks[i], &regions);
+		sdp_region_put(region);
+	}
+
+	spin_lock(&so_dev.lock);
+	list_del(&client->client_node);
+	spin_unlock(&so_dev.lock);
+
+	kfree(client->name);
+	kfree(client);
+}
+
+static void *smaf_optee_create_context(void)
+{
+	struct sdp_client *client;
+
+	client = sdp_client_create();
+	if (client)
+		sdp_trace_record(SDP_TRACE_CREATE_CTX, client, NULL, 0, 0,
+				 DMA_NONE, false);
+
+	return client;
+}
+
+static int smaf_optee_destroy_context(void *ctx)
+{
+	struct sdp_client *client = ctx;
+
+	if (!client)
+		return -EINVAL;
+
+	sdp_trace_record(SDP_TRACE_DESTROY_CTX, client, NULL, 0, 0,
+			 DMA_NONE, false);
+	sdp_client_destroy(client);
+	return 0;
+
+}
+
+static bool smaf_optee_grant_access(void *ctx,
+				    struct device *dev,
+				    size_t addr, size_t size,
+				    enum dma_data_direction direction)
+{
+	struct sdp_client *client = ctx;
+	uint32_t handle;
+	int ret;
+
+	ret = sdp_device_handle(dev, &handle);
+	if (!ret)
+		ret = sdp_grant_access(client, handle, addr, size, direction);
+
+	sdp_trace_record(SDP_TRACE_GRANT, client, sdp_device_name(dev),
+			 addr, size, direction, ret);
+
+	return !ret;
+}
+
+static void smaf_optee_revoke_access(void *ctx,
+				     struct device *dev,
+				     size_t addr, size_t size,
+				     enum dma_data_direction direction)
+{
+	struct sdp_client *client = ctx;
+	uint32_t handle;
+	int ret;
+
+	ret = sdp_device_handle(dev, &handle);
+	if (!ret)
+		ret = sdp_revoke_access(client, handle, addr, size, direction);
+
+	sdp_trace_record(SDP_TRACE_REVOKE, client, sdp_device_name(dev),
+			 addr, size, direction, ret);
+}
+
+/**
+ * smaf_optee_grant_access_sg - give a device access to a scattered buffer
+ *
+ * @ctx: context given by smaf_optee_sec.create_ctx
+ * @dev: the device
+ * @sgt: the buffer, mapped for @dev
+ * @direction: access direction
+ *
+ * The first grant creates a single region made of all the entries of @sgt,
+ * later calls with the same entries update its permissions.
+ */
+bool smaf_optee_grant_access_sg(void *ctx, struct device *dev,
+				struct sg_table *sgt,
+				enum dma_data_direction direction)
+{
+	struct sdp_client *client = ctx;
+	uint32_t handle;
+
+	if (sdp_device_handle(dev, &handle))
+		return false;
+
+	return !sdp_grant_access_sg(client, handle, sgt, direction);
+}
+EXPORT_SYMBOL(smaf_optee_grant_access_sg);
+
+/**
+ * smaf_optee_revoke_access_sg - remove a device access to a scattered buffer
+ *
+ * @ctx: context given by smaf_optee_sec.create_ctx
+ * @dev: the device
+ * @sgt: the buffer given to smaf_optee_grant_access_sg()
+ * @direction: access direction
+ */
+void smaf_optee_revoke_access_sg(void *ctx, struct device *dev,
+				 struct sg_table *sgt,
+				 enum dma_data_direction direction)
+{
+	struct sdp_client *client = ctx;
+	uint32_t handle;
+
+	if (sdp_device_handle(dev, &handle))
+		return;
+
+	sdp_revoke_access_sg(client, handle, sgt, direction);
+}
+EXPORT_SYMBOL(smaf_optee_revoke_access_sg);
+
+/**
+ * smaf_optee_register_pipeline - register a chain of devices
+ *
+ * @name: name of the pipeline, a pipeline with the same name is replaced
+ * @stages: the devices and their access direction, in the order they
+ *	    access the buffers
+ * @nr_stages: number of stages
+ *
+ * return 0 on success
+ */
+int smaf_optee_register_pipeline(const char *name,
+				 const struct smaf_optee_stage *stages,
+				 unsigned int nr_stages)
+{
+	struct sdp_pipeline *pipeline;
+	int id;
+
+	if (!nr_stages || nr_stages > SDP_MAX_PIPELINE_STAGES ||
+	    !name[0] || strlen(name) >= SDP_PIPELINE_NAME_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&so_dev.pipelines_lock);
+
+	id = sdp_pipeline_find(name);
+	if (id < 0)
+		id = sdp_pipeline_find("");
+	if (id < 0) {
+		mutex_unlock(&so_dev.pipelines_lock);
+		return -ENOSPC;
+	}
+
+	pipeline = &so_dev.pipelines[id];
+	strlcpy(pipeline->name, name, sizeof(pipeline->name));
+	memcpy(pipeline->stages, stages, nr_stages * sizeof(*stages));
+	pipeline->nr_stages = nr_stages;
+	/* registered in the TA when first applied */
+	pipeline->registered = false;
+
+	mutex_unlock(&so_dev.pipelines_lock);
+	return 0;
+}
+EXPORT_SYMBOL(smaf_optee_register_pipeline);
+
+/**
+ * smaf_optee_unregister_pipeline - remove a pipeline
+ *
+ * @name: name given to smaf_optee_register_pipeline()
+ *
+ * the access already given by the pipeline is not changed
+ */
+void smaf_optee_unregister_pipeline(const char *name)
+{
+	struct sdp_pipeline *pipeline;
+	int id;
+
+	mutex_lock(&so_dev.pipelines_lock);
+
+	id = sdp_pipeline_find(name);
+	if (id >= 0 && name[0]) {
+		pipeline = &so_dev.pipelines[id];
+		if (pipeline->registered &&
+		    pipeline->gen == so_dev.session_gen)
+			sdp_ta_pipeline_register(id, NULL, 0);
+		memset(pipeline, 0, sizeof(*pipeline));
+	}
+
+	mutex_unlock(&so_dev.pipelines_lock);
+}
+EXPORT_SYMBOL(smaf_optee_unregister_pipeline);
+
+/**
+ * smaf_optee_apply_pipeline - give all the devices of a pipeline access
+ * to a buffer
+ *
+ * @ctx: context given by smaf_optee_sec.create_ctx
+ * @name: name given to smaf_optee_register_pipeline()
+ * @addr: DMA address of the buffer
+ * @size: size of the buffer
+ *
+ * The TA checks and sets the permissions of all the stages in one call,
+ * none is given if one of the stages is refused.
+ */
+bool smaf_optee_apply_pipeline(void *ctx, const char *name,
+			       size_t addr, size_t size)
+{
+	struct sdp_client *client = ctx;
+
+	return !sdp_apply_pipeline(client, name, addr, size);
+}
+EXPORT_SYMBOL(smaf_optee_apply_pipeline);
+
+/**
+ * smaf_optee_apply_pipeline_pool - give all the devices of a pipeline access
+ * to all the buffers of a pool
+ *
+ * @pool: pool identifier
+ * @name: name given to smaf_optee_register_pipeline()
+ *
+ * The pool may be attached to a context or detached. Each buffer gets the
+ * access of all the stages or none of them.
+ *
+ * return 0 if all the buffers got the access
+ */
+int smaf_optee_apply_pipeline_pool(unsigned int pool, const char *name)
+{
+	return sdp_apply_pipeline_pool(pool, name);
+}
+EXPORT_SYMBOL(smaf_optee_apply_pipeline_pool);
+
+/**
+ * smaf_optee_attach_pool - keep the regions of a context in a pool
+ *
+ * @ctx: context given by smaf_optee_sec.create_ctx
+ * @pool: pool identifier
+ *
+ * The regions created by the context are added to the pool. When the
+ * context is destroyed they are kept in the TA with their permissions, and
+ * given as they are to the next context attaching the pool. A pool is used
+ * by one context at a time.
+ *
+ * The TA holds at most SMAF_OPTEE_MAX_POOLS pools of
+ * SMAF_OPTEE_MAX_POOL_REGIONS regions each, a grant that would create a
+ * region beyond these limits is refused.
+ *
+ * return 0 on success
+ */
+int smaf_optee_attach_pool(void *ctx, unsigned int pool)
+{
+	struct sdp_client *client = ctx;
+
+	return sdp_pool_attach(client, pool);
+}
+EXPORT_SYMBOL(smaf_optee_attach_pool);
+
+/**
+ * smaf_optee_release_pool - destroy a pool and its regions
+ *
+ * @pool: pool identifier
+ *
+ * return 0 on success, -EBUSY if a context uses the pool
+ */
+int smaf_optee_release_pool(unsigned int pool)
+{
+	struct sdp_pool *p;
+	int ret = -EINVAL;
+
+	mutex_lock(&so_dev.pools_lock);
+	p = sdp_pool_find(pool);
+	if (p)
+		ret = sdp_pool_release(p);
+	mutex_unlock(&so_dev.pools_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(smaf_optee_release_pool);
+
+static struct smaf_secure smaf_optee_sec = {
+	.create_ctx = smaf_optee_create_context,
+	.destroy_ctx = smaf_optee_destroy_context,
+	.grant_access = smaf_optee_grant_access,
+	.revoke_access = smaf_optee_revoke_access,
+};
+
+/* trace replay */
+#define SDP_REPLAY_CLIENTS	32
+#define SDP_REPLAY_DEVICES	16
+
+/**
+ * struct sdp_replay - state of a replay, from open to release of the file
+ *
+ * @clients: replay contexts, by traced context id
+ * @devices: resolved device handles, by traced device name
+ * @last_ns: time of the previous entry, to pace a realtime replay
+ * @start: time of the first entry
+ * @ops: number of replayed entries
+ * @mismatches: number of entries which failed when the traced call didn't,
+ *		or the opposite
+ * @partial: bytes of an incomplete entry kept from the previous write
+ */
+struct sdp_replay {
+	struct {
+		uint32_t id;
+		struct sdp_client *client;
+	} clients[SDP_REPLAY_CLIENTS];
+	struct {
+		char name[SDP_TRACE_NAME_SIZE];
+		uint32_t handle;
+	} devices[SDP_REPLAY_DEVICES];
+	unsigned int nr_devices;
+	uint64_t last_ns;
+	ktime_t start;
+	unsigned int ops;
+	unsigned int mismatches;
+	struct sdp_trace_entry entry;
+	size_t partial;
+};
+
+/* context replaying a traced context, created on first use */
+static struct sdp_client *sdp_replay_client(struct sdp_replay *replay,
+					    uint32_t id, bool create)
+{
+	struct sdp_client *client;
+	int i, free = -1;
+
+	for (i = 0; i < SDP_REPLAY_CLIENTS; i++) {
+		if (replay->clients[i].client && replay->clients[i].id == id)
+			return replay->clients[i].client;
+		if (!replay->clients[i].client && free < 0)
+			free = i;
+	}
+
+	if (!create || free < 0)
+		return NULL;
+
+	client = sdp_client_create();
+	if (!client)
+		return NULL;
+
+	replay->clients[free].id = id;
+	replay->clients[free].client = client;
+
+	return client;
 }
 
-static int sdp_ta_region_destroy(struct sdp_region *region)
+static int sdp_replay_device(struct sdp_replay *replay, const char *name,
+			     uint32_t *handle)
 {
-	TEEC_Operation op;
-	TEEC_Result res;
-	uint32_t err_origin;
+	int i;
 
-	memset(&op, 0, sizeof(op));
-
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
-					 TEEC_NONE, TEEC_NONE);
+	for (i = 0; i < replay->nr_devices; i++) {
+		if (!strcmp(replay->devices[i].name, name)) {
+			*handle = replay->devices[i].handle;
+			return 0;
+		}
+	}
 
-	op.params[0].value.a = region->id;
+	if (sdp_init_session())
+		return -EINVAL;
 
-	res = TEEC_InvokeCommand(&so_dev.session, TA_SDP_DESTROY_REGION,
-				 &op, &err_origin);
-	if (res != TEEC_SUCCESS) {
-		printk(KERN_ERR "failed to destroy region 0x%x 0x%x\n",
-		       res, err_origin);
+	if (sdp_ta_resolve_device(name, handle))
 		return -EINVAL;
+
+	if (replay->nr_devices < SDP_REPLAY_DEVICES) {
+		i = replay->nr_devices++;
+		strlcpy(replay->devices[i].name, name,
+			sizeof(replay->devices[i].name));
+		replay->devices[i].handle = *handle;
 	}
 
 	return 0;
 }
 
-static int sdp_ta_region_update(struct sdp_region *region, struct device *dev,
-				enum dma_data_direction dir, bool add)
+/* wait for the time elapsed between the previous entry and this one */
+static void sdp_replay_pace(struct sdp_replay *replay, uint64_t time_ns)
 {
-	TEEC_Operation op;
-	TEEC_Result res;
-	uint32_t err_origin;
-	const char *name;
+	uint64_t delta_us;
+
+	if (replay->ops && replay_realtime && time_ns > replay->last_ns) {
+		delta_us = div_u64(time_ns - replay->last_ns, NSEC_PER_USEC);
+		if (delta_us >= 20 * USEC_PER_MSEC)
+			msleep(div_u64(delta_us, USEC_PER_MSEC));
+		else if (delta_us)
+			usleep_range(delta_us, delta_us + delta_us / 8 + 1);
+	}
 
-	memset(&op, 0, sizeof(op));
+	replay->last_ns = time_ns;
+}
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
-					 TEEC_MEMREF_TEMP_INPUT,
-					 TEEC_VALUE_INPUT,
-					 TEEC_NONE);
+static void sdp_replay_entry(struct sdp_replay *replay,
+			     struct sdp_trace_entry *entry)
+{
+	struct sdp_client *client;
+	uint32_t handle;
+	int ret = -EINVAL;
+	int i;
+
+	sdp_replay_pace(replay, entry->time_ns);
+	if (!replay->ops)
+		replay->start = ktime_get();
+	replay->ops++;
+
+	entry->device[SDP_TRACE_NAME_SIZE - 1] = '\0';
+
+	switch (entry->op) {
+	case SDP_TRACE_CREATE_CTX:
+		client = sdp_replay_client(replay, entry->client, true);
+		ret = client ? 0 : -ENOMEM;
+		break;
+	case SDP_TRACE_DESTROY_CTX:
+		for (i = 0; i < SDP_REPLAY_CLIENTS; i++) {
+			client = replay->clients[i].client;
+			if (client && replay->clients[i].id == entry->client) {
+				sdp_client_destroy(client);
+				replay->clients[i].client = NULL;
+				ret = 0;
+				break;
+			}
+		}
+		break;
+	case SDP_TRACE_GRANT:
+	case SDP_TRACE_REVOKE:
+		client = sdp_replay_client(replay, entry->client, true);
+		if (!client || sdp_replay_device(replay, entry->device, &handle))
+			break;
+		if (entry->op == SDP_TRACE_GRANT)
+			ret = sdp_grant_access(client, handle, entry->addr,
+					       entry->size, entry->dir);
+		else
+			ret = sdp_revoke_access(client, handle, entry->addr,
+						entry->size, entry->dir);
+		break;
+	}
 
-	op.params[0].value.a = region->id;
-	op.params[0].value.b = add;
+	if (!ret != !entry->failed)
+		replay->mismatches++;
+}
 
-	if (dev->driver)
-		name = dev->driver->name;
-	else
-		name = "cpu";
+static int smaf_optee_replay_open(struct inode *inode, struct file *file)
+{
+	file->private_data = kzalloc(sizeof(struct sdp_replay), GFP_KERNEL);
+	if (!file->private_data)
+		return -ENOMEM;
 
-	op.params[1].tmpref.buffer = (void*)name;
-	op.params[1].tmpref.size = strlen(name) + 1;
+	return 0;
+}
 
-	op.params[2].value.a = dir;
+/* entries may be split across writes */
+static ssize_t smaf_optee_replay_write(struct file *file,
+				       const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct sdp_replay *replay = file->private_data;
+	size_t done = 0, len;
+
+	while (done < count) {
+		len = min(count - done, sizeof(replay->entry) - replay->partial);
+		if (copy_from_user((u8 *)&replay->entry + replay->partial,
+				   buf + done, len))
+			return done ? done : -EFAULT;
+
+		done += len;
+		replay->partial += len;
+		if (replay->partial < sizeof(replay->entry))
+			break;
+
+		sdp_replay_entry(replay, &replay->entry);
+		replay->partial = 0;
+	}
 
-	res = TEEC_InvokeCommand(&so_dev.session, TA_SDP_UPDATE_REGION,
-				 &op, &err_origin);
-	if (res != TEEC_SUCCESS) {
-		printk(KERN_ERR "failed to update region 0x%x 0x%x\n",
-		       res, err_origin);
-		return -EINVAL;
+	return count;
+}
+
+/* the contexts still open at the end of the trace are destroyed */
+static int smaf_optee_replay_release(struct inode *inode, struct file *file)
+{
+	struct sdp_replay *replay = file->private_data;
+	int i;
+
+	for (i = 0; i < SDP_REPLAY_CLIENTS; i++) {
+		if (replay->clients[i].client)
+			sdp_client_destroy(replay->clients[i].client);
 	}
 
+	if (replay->ops)
+		printk(KERN_INFO "smaf-optee: replayed %u operations in %lld us, %u mismatches\n",
+		       replay->ops,
+		       ktime_us_delta(ktime_get(), replay->start),
+		       replay->mismatches);
+
+	kfree(replay);
 	return 0;
 }
 
-static int sdp_init_session(void)
+static const struct file_operations so_replay_fops = {
+	.open    = smaf_optee_replay_open,
+	.write   = smaf_optee_replay_write,
+	.llseek  = no_llseek,
+	.release = smaf_optee_replay_release,
+};
+
+/* debugfs helpers */
+#define MAX_DUMP_SIZE 2048
+static int smaf_optee_ta_dump_status(struct seq_file *s, void *unused)
 {
+	TEEC_Operation op;
 	TEEC_Result res;
 	uint32_t err_origin;
-	TEEC_UUID uuid = TA_SDP_UUID;
+	char *dump;
 
-	if (so_dev.session_initialized)
+	if (sdp_init_session())
 		return 0;
 
-	res = TEEC_InitializeContext(NULL, &so_dev.ctx);
-	if (res != TEEC_SUCCESS) {
-		printk (KERN_ERR "TEEC_InitializeContext failed %d\n", res);
-		return -EINVAL;
-	}
+	memset(&op, 0, sizeof(op));
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	dump = kzalloc(MAX_DUMP_SIZE, GFP_KERNEL);
+	op.params[0].tmpref.buffer = (void *)dump;
+	op.params[0].tmpref.size = MAX_DUMP_SIZE - 1;
 
-	res = TEEC_OpenSession(&so_dev.ctx, &so_dev.session, &uuid,
-			TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
+	res = sdp_invoke(TA_SDP_DUMP_STATUS, &op, &err_origin);
 	if (res != TEEC_SUCCESS) {
-		printk(KERN_ERR "TEEC_OpenSession failed %d\n", res);
-		TEEC_FinalizeContext(&so_dev.ctx);
+		printk(KERN_ERR "failed to dump status 0x%x 0x%x\n",
+		       res, err_origin);
+		kfree(dump);
 		return -EINVAL;
 	}
 
-	so_dev.session_initialized = true;
+	seq_printf(s, "%s", dump);
+
+	kfree(dump);
 	return 0;
 }
 
-static void sdp_destroy_session(void)
+static int smaf_optee_debug_open(struct inode *inode, struct file *file)
 {
-	if (!so_dev.session_initialized)
-		return;
-
-	TEEC_CloseSession(&so_dev.session);
-	TEEC_FinalizeContext(&so_dev.ctx);
-	so_dev.session_initialized = false;
+	return single_open(file, smaf_optee_ta_dump_status, inode->i_private);
 }
 
-/* internal functions */
-static int sdp_region_add(struct sdp_region *region, struct device *dev,
-			  enum dma_data_direction dir)
-{
-	return sdp_ta_region_update(region, dev, dir, true);
-}
+static const struct file_operations so_debug_fops = {
+	.open    = smaf_optee_debug_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
 
-static int sdp_region_remove(struct sdp_region *region, struct device *dev,
-			     enum dma_data_direction dir)
+static int smaf_optee_shadow_show(struct seq_file *s, void *unused)
 {
-	return sdp_ta_region_update(region, dev, dir, false);
+	seq_printf(s, "hits %lld\n", (long long)atomic64_read(&so_dev.shadow_hits));
+	seq_printf(s, "misses %lld\n",
+		   (long long)atomic64_read(&so_dev.shadow_misses));
+	return 0;
 }
 
-static struct sdp_region *sdp_region_create(struct sdp_client *client,
-					    dma_addr_t addr, size_t size)
+static int smaf_optee_shadow_open(struct inode *inode, struct file *file)
 {
-	struct sdp_region *region;
-	int region_id;
-
-	/* here call TA to create the region */
-	if (sdp_init_session())
-		return NULL;
-
-	region_id = sdp_ta_region_create(addr, size);
-	if (region_id < 0)
-		return NULL;
-
-	region = kzalloc(sizeof(*region), GFP_KERNEL);
-	if (!region)
-		return NULL;
-
-	INIT_LIST_HEAD(&region->region_node);
-	region->addr = addr;
-	region->size = size;
-	region->id = region_id;
-
-	mutex_lock(&client->lock);
-	list_add(&region->region_node, &client->regions_head);
-	mutex_unlock(&client->lock);
-
-	return region;
+	return single_open(file, smaf_optee_shadow_show, inode->i_private);
 }
 
-static int sdp_region_destroy(struct sdp_client *client,
-			      struct sdp_region *region)
-{
-	if (sdp_ta_region_destroy(region))
-		return -EINVAL;
-
-	mutex_lock(&client->lock);
-	list_del(&region->region_node);
-	mutex_unlock(&client->lock);
+static const struct file_operations so_shadow_fops = {
+	.open    = smaf_optee_shadow_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
 
-	kfree(region);
+static int smaf_optee_regions_show(struct seq_file *s, void *unused)
+{
+	seq_printf(s, "coalesced %lld\n",
+		   (long long)atomic64_read(&so_dev.coalesced));
+	seq_printf(s, "splits %lld\n",
+		   (long long)atomic64_read(&so_dev.splits));
 	return 0;
 }
 
-static struct sdp_region *sdp_region_find(struct sdp_client *client,
-					  dma_addr_t addr, size_t size)
+static int smaf_optee_regions_open(struct inode *inode, struct file *file)
 {
-	struct sdp_region *region;
+	return single_open(file, smaf_optee_regions_show, inode->i_private);
+}
 
-	mutex_lock(&client->lock);
+static const struct file_operations so_regions_fops = {
+	.open    = smaf_optee_regions_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
 
-	list_for_each_entry(region, &client->regions_head, region_node) {
-		if (region->addr == addr && region->size == size) {
-			mutex_unlock(&client->lock);
-			return region;
-		}
+static int smaf_optee_ring_show(struct seq_file *s, void *unused)
+{
+	struct sdp_ring *ring = READ_ONCE(so_dev.ring);
+	uint32_t size = 0, queued = 0;
+
+	if (ring) {
+		size = ring->size;
+		queued = READ_ONCE(ring->tail) - READ_ONCE(so_dev.ring_reap);
 	}
 
-	mutex_unlock(&client->lock);
-	return NULL;
+	seq_printf(s, "size %u\n", size);
+	seq_printf(s, "queued %u\n", queued);
+	seq_printf(s, "errors %lld\n",
+		   (long long)atomic64_read(&so_dev.ring_errors));
+	return 0;
 }
 
-static int sdp_grant_access(struct sdp_client *client, struct device *dev,
-		     dma_addr_t addr, size_t size, enum dma_data_direction dir)
+static int smaf_optee_ring_open(struct inode *inode, struct file *file)
 {
-	struct sdp_region *region;
+	return single_open(file, smaf_optee_ring_show, inode->i_private);
+}
 
-	region = sdp_region_find(client, addr, size);
+static const struct file_operations so_ring_fops = {
+	.open    = smaf_optee_ring_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
 
-	if (!region)
-		region = sdp_region_create(client, addr, size);
+static const char * const sdp_cmd_names[SDP_NR_COMMANDS] = {
+	[TA_SDP_CREATE_REGION]	= "create",
+	[TA_SDP_DESTROY_REGION]	= "destroy",
+	[TA_SDP_UPDATE_REGION]	= "update",
+	[TA_SDP_DUMP_STATUS]	= "dump",
+	[TA_SDP_BATCH]		= "batch",
+	[TA_SDP_RESOLVE_DEVICE]	= "resolve",
+	[TA_SDP_RING_DRAIN]	= "ring_drain",
+	[TA_SDP_GET_STATS]	= "get_stats",
+	[TA_SDP_CREATE_REGION_SG] = "create_sg",
+	[TA_SDP_RESIZE_REGION]	= "resize",
+	[TA_SDP_REGISTER_PIPELINE] = "register_pipeline",
+	[TA_SDP_APPLY_PIPELINE]	= "apply_pipeline",
+	[TA_SDP_POOL]		= "pool",
+	[TA_SDP_DESTROY_ALL]	= "destroy_all",
+	[TA_SDP_LOOKUP_ADDR]	= "lookup_addr",
+};
 
-	if (!region)
-		return -EINVAL;
+/*
+ * One line per command: name, calls, errors, total round trip time in ns,
+ * time spent in the TA and in the transport (world switches, marshalling)
+ * in ns, calls per second and the latency histogram buckets.
+ */
+static int smaf_optee_stats_show(struct seq_file *s, void *unused)
+{
+	struct sdp_cmd_stats *stats;
+	s64 elapsed;
+	u64 calls, total, ta;
+	int i, j;
+
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), so_dev.stats_reset));
+
+	seq_printf(s, "# command calls errors total_ns ta_ns transport_ns calls_per_sec latency_log2_ns[0-%d]\n",
+		   SDP_LATENCY_BUCKETS - 1);
+
+	for (i = 0; i < SDP_NR_COMMANDS; i++) {
+		stats = &so_dev.stats[i];
+		calls = atomic64_read(&stats->calls);
+		total = atomic64_read(&stats->total_ns);
+		ta = atomic64_read(&stats->ta_ns);
+
+		seq_printf(s, "%s %llu %llu %llu %llu %llu %llu",
+			   sdp_cmd_names[i],
+			   (unsigned long long)calls,
+			   (unsigned long long)atomic64_read(&stats->errors),
+			   (unsigned long long)total,
+			   (unsigned long long)ta,
+			   (unsigned long long)(total > ta ? total - ta : 0),
+			   elapsed > 0 ? (unsigned long long)
+			   div64_u64(calls * NSEC_PER_SEC, elapsed) : 0ULL);
+
+		for (j = 0; j < SDP_LATENCY_BUCKETS; j++)
+			seq_printf(s, " %llu", (unsigned long long)
+				   atomic64_read(&stats->latency[j]));
+
+		seq_puts(s, "\n");
+	}
 
-	return sdp_region_add(region, dev, dir);
+	return 0;
+}
 
+static int smaf_optee_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, smaf_optee_stats_show, inode->i_private);
 }
 
-static int sdp_revoke_access(struct sdp_client *client, struct device *dev,
-		     dma_addr_t addr, size_t size, enum dma_data_direction dir)
+/* any write resets the statistics */
+static ssize_t smaf_optee_stats_write(struct file *file,
+				      const char __user *buf,
+				      size_t count, loff_t *ppos)
 {
-	struct sdp_region *region;
+	sdp_stats_reset();
+	return count;
+}
 
-	region = sdp_region_find(client, addr, size);
+static int smaf_optee_sessions_show(struct seq_file *s, void *unused)
+{
+	seq_printf(s, "sessions %u\n", so_dev.nr_sessions);
+	seq_printf(s, "waits %lld\n",
+		   (long long)atomic64_read(&so_dev.sessions_waits));
+	return 0;
+}
 
-	if (!region)
-		return -EINVAL;
+static int smaf_optee_sessions_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, smaf_optee_sessions_show, inode->i_private);
+}
 
-	return sdp_region_remove(region, dev, dir);
+static const struct file_operations so_sessions_fops = {
+	.open    = smaf_optee_sessions_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
 
-}
+struct sdp_trace_snapshot {
+	size_t size;
+	struct sdp_trace_entry entries[];
+};
 
-static void *smaf_optee_create_context(void)
+/* the trace is copied at open, from the oldest to the newest entry */
+static int smaf_optee_trace_open(struct inode *inode, struct file *file)
 {
-	struct sdp_client *client;
-
-	client = kzalloc(sizeof(*client), GFP_KERNEL);
-	if (!client)
-		return NULL;
+	struct sdp_trace_snapshot *snapshot;
+	u64 head, first, i;
+	size_t count;
 
-	mutex_init(&client->lock);
-	INIT_LIST_HEAD(&client->client_node);
-	INIT_LIST_HEAD(&client->regions_head);
+	if (!so_dev.trace)
+		return -ENODEV;
 
-	client->name = kstrdup("smaf-optee", GFP_KERNEL);
+	head = atomic64_read(&so_dev.trace_head);
+	first = head > so_dev.trace_mask ? head - so_dev.trace_mask - 1 : 0;
+	count = head - first;
 
-	mutex_lock(&so_dev.lock);
-	list_add(&client->client_node, &so_dev.clients_head);
-	mutex_unlock(&so_dev.lock);
+	snapshot = vmalloc(sizeof(*snapshot) +
+			   count * sizeof(struct sdp_trace_entry));
+	if (!snapshot)
+		return -ENOMEM;
 
-	return client;
+	for (i = 0; i < count; i++)
+		snapshot->entries[i] =
+			so_dev.trace[(first + i) & so_dev.trace_mask];
+	snapshot->size = count * sizeof(struct sdp_trace_entry);
 
+	file->private_data = snapshot;
+	return 0;
 }
 
-static int smaf_optee_destroy_context(void *ctx)
+static ssize_t smaf_optee_trace_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
 {
-	struct sdp_client *client = ctx;
-	struct sdp_region *region, *tmp;
+	struct sdp_trace_snapshot *snapshot = file->private_data;
 
-	if (!client)
-		return -EINVAL;
-
-	list_for_each_entry_safe(region, tmp, &client->regions_head, region_node) {
-		sdp_region_destroy(client, region);
-	}
+	return simple_read_from_buffer(buf, count, ppos, snapshot->entries,
+				       snapshot->size);
+}
 
-	mutex_lock(&so_dev.lock);
-	list_del(&client->client_node);
-	mutex_unlock(&so_dev.lock);
+/* any write clears the trace */
+static ssize_t smaf_optee_trace_write(struct file *file,
+				      const char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	atomic64_set(&so_dev.trace_head, 0);
+	return count;
+}
 
-	kfree(client->name);
-	kfree(client);
+static int smaf_optee_trace_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
 	return 0;
-
 }
 
-static bool smaf_optee_grant_access(void *ctx,
-				    struct device *dev,
-				    size_t addr, size_t size,
-				    enum dma_data_direction direction)
+static const struct file_operations so_trace_fops = {
+	.open    = smaf_optee_trace_open,
+	.read    = smaf_optee_trace_read,
+	.write   = smaf_optee_trace_write,
+	.llseek  = default_llseek,
+	.release = smaf_optee_trace_release,
+};
+
+static int smaf_optee_startup_show(struct seq_file *s, void *unused)
 {
-	struct sdp_client *client = ctx;
+	if (!completion_done(&so_dev.init_done)) {
+		seq_puts(s, "in progress\n");
+		return 0;
+	}
 
-	return !sdp_grant_access(client, dev, addr, size, direction);
+	seq_printf(s, "context_us %lld\n", so_dev.startup.context_us);
+	seq_printf(s, "sessions_us %lld\n", so_dev.startup.sessions_us);
+	seq_printf(s, "warmup_us %lld\n", so_dev.startup.warmup_us);
+	seq_printf(s, "total_us %lld\n", so_dev.startup.total_us);
+	seq_printf(s, "result %d\n", so_dev.startup.ret);
+	return 0;
 }
 
-static void smaf_optee_revoke_access(void *ctx,
-				     struct device *dev,
-				     size_t addr, size_t size,
-				     enum dma_data_direction direction)
+static int smaf_optee_startup_open(struct inode *inode, struct file *file)
 {
-	struct sdp_client *client = ctx;
-	sdp_revoke_access(client, dev, addr, size, direction);
+	return single_open(file, smaf_optee_startup_show, inode->i_private);
 }
 
-static struct smaf_secure smaf_optee_sec = {
-	.create_ctx = smaf_optee_create_context,
-	.destroy_ctx = smaf_optee_destroy_context,
-	.grant_access = smaf_optee_grant_access,
-	.revoke_access = smaf_optee_revoke_access,
+static const struct file_operations so_startup_fops = {
+	.open    = smaf_optee_startup_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
 };
 
-/* debugfs helpers */
-#define MAX_DUMP_SIZE 2048
-static int smaf_optee_ta_dump_status(struct seq_file *s, void *unused)
+static const struct file_operations so_stats_fops = {
+	.open    = smaf_optee_stats_open,
+	.read    = seq_read,
+	.write   = smaf_optee_stats_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/* cumulated statistics of the TA: command, calls and time spent in us */
+static int smaf_optee_ta_stats_show(struct seq_file *s, void *unused)
 {
+	struct sdp_ta_stats *stats;
 	TEEC_Operation op;
 	TEEC_Result res;
 	uint32_t err_origin;
-	char *dump;
+	int i;
 
 	if (sdp_init_session())
 		return 0;
 
+	stats = kcalloc(SDP_NR_COMMANDS, sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+
 	memset(&op, 0, sizeof(op));
 
 	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT,
@@ -383,32 +3932,34 @@ static int smaf_optee_ta_dump_status(struct seq_file *s, void *unused)
 					 TEEC_NONE,
 					 TEEC_NONE);
 
-	dump = kzalloc(MAX_DUMP_SIZE, GFP_KERNEL);
-	op.params[0].tmpref.buffer = (void *)dump;
-	op.params[0].tmpref.size = MAX_DUMP_SIZE - 1;
+	op.params[0].tmpref.buffer = stats;
+	op.params[0].tmpref.size = SDP_NR_COMMANDS * sizeof(*stats);
 
-	res = TEEC_InvokeCommand(&so_dev.session, TA_SDP_DUMP_STATUS,
-				 &op, &err_origin);
+	res = sdp_invoke(TA_SDP_GET_STATS, &op, &err_origin);
 	if (res != TEEC_SUCCESS) {
-		printk(KERN_ERR "failed to dump status 0x%x 0x%x\n",
+		printk(KERN_ERR "failed to get TA stats 0x%x 0x%x\n",
 		       res, err_origin);
-		kfree(dump);
+		kfree(stats);
 		return -EINVAL;
 	}
 
-	seq_printf(s, "%s", dump);
+	seq_puts(s, "# command calls time_us\n");
+	for (i = 0; i < SDP_NR_COMMANDS; i++)
+		seq_printf(s, "%s %llu %llu\n", sdp_cmd_names[i],
+			   (unsigned long long)stats[i].calls,
+			   (unsigned long long)stats[i].time_us);
 
-	kfree(dump);
+	kfree(stats);
 	return 0;
 }
 
-static int smaf_optee_debug_open(struct inode *inode, struct file *file)
+static int smaf_optee_ta_stats_open(struct inode *inode, struct file *file)
 {
-	return single_open(file, smaf_optee_ta_dump_status, inode->i_private);
+	return single_open(file, smaf_optee_ta_stats_show, inode->i_private);
 }
 
-static const struct file_operations so_debug_fops = {
-	.open    = smaf_optee_debug_open,
+static const struct file_operations so_ta_stats_fops = {
+	.open    = smaf_optee_ta_stats_open,
 	.read    = seq_read,
 	.llseek  = seq_lseek,
 	.release = single_release,
@@ -416,15 +3967,52 @@ static const struct file_operations so_debug_fops = {
 
 static int __init smaf_optee_init(void)
 {
-	mutex_init(&so_dev.lock);
+	spin_lock_init(&so_dev.lock);
+	mutex_init(&so_dev.session_lock);
+	init_waitqueue_head(&so_dev.sessions_wq);
 	INIT_LIST_HEAD(&so_dev.clients_head);
+	hash_init(so_dev.devices);
+	spin_lock_init(&so_dev.devices_lock);
+	spin_lock_init(&so_dev.ring_lock);
+	mutex_init(&so_dev.ring_drain_lock);
+	mutex_init(&so_dev.pipelines_lock);
+	INIT_LIST_HEAD(&so_dev.pools);
+	mutex_init(&so_dev.pools_lock);
+	init_completion(&so_dev.init_done);
+	INIT_WORK(&so_dev.init_work, sdp_init_work);
+	INIT_WORK(&so_dev.ring_work, sdp_ring_work);
+	sdp_stats_reset();
+	if (sdp_trace_init())
+		printk(KERN_ERR "failed to allocate the trace, tracing disabled\n");
 
 	so_dev.debug_root = debugfs_create_dir("smaf-optee", NULL);
 	debugfs_create_file("dump", S_IRUGO, so_dev.debug_root,
 			    &so_dev, &so_debug_fops);
+	debugfs_create_file("shadow", S_IRUGO, so_dev.debug_root,
+			    &so_dev, &so_shadow_fops);
+	debugfs_create_file("ring", S_IRUGO, so_dev.debug_root,
+			    &so_dev, &so_ring_fops);
+	debugfs_create_file("regions", S_IRUGO, so_dev.debug_root,
+			    &so_dev, &so_regions_fops);
+	debugfs_create_file("stats", S_IRUGO | S_IWUSR, so_dev.debug_root,
+			    &so_dev, &so_stats_fops);
+	debugfs_create_file("ta_stats", S_IRUGO, so_dev.debug_root,
+			    &so_dev, &so_ta_stats_fops);
+	debugfs_create_file("sessions", S_IRUGO, so_dev.debug_root,
+			    &so_dev, &so_sessions_fops);
+	debugfs_create_file("trace", S_IRUGO | S_IWUSR, so_dev.debug_root,
+			    &so_dev, &so_trace_fops);
+	debugfs_create_file("replay", S_IWUSR, so_dev.debug_root,
+			    &so_dev, &so_replay_fops);
+	debugfs_create_file("startup", S_IRUGO, so_dev.debug_root,
+			    &so_dev, &so_startup_fops);
 
 	so_dev.session_initialized = false;
 
+	/* open the sessions in the background, the first grant waits for it */
+	so_dev.init_start = ktime_get();
+	queue_work(system_unbound_wq, &so_dev.init_work);
+
 	smaf_register_secure(&smaf_optee_sec);
 
 	return 0;
@@ -433,8 +4021,19 @@ module_init(smaf_optee_init);
 
 static void __exit smaf_optee_exit(void)
 {
+	struct sdp_pool *pool, *tmp;
+
 	smaf_unregister_secure(&smaf_optee_sec);
+	flush_work(&so_dev.init_work);
+	debugfs_remove_recursive(so_dev.debug_root);
+
+	mutex_lock(&so_dev.pools_lock);
+	list_for_each_entry_safe(pool, tmp, &so_dev.pools, pool_node)
+		sdp_pool_release(pool);
+	mutex_unlock(&so_dev.pools_lock);
+
 	sdp_destroy_session();
+	sdp_trace_release();
 }
 module_exit(smaf_optee_exit);
 
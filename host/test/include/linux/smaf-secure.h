@@ -0,0 +1,28 @@
+/*
+ * smaf-secure.h
+ *
+ * Secure module interface of SMAF, the harness plays the allocator side.
+ *
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#ifndef _SMAF_SECURE_H_
+#define _SMAF_SECURE_H_
+
+#include "../../kshim.h"
+
+struct smaf_secure {
+	void *(*create_ctx)(void);
+	int (*destroy_ctx)(void *ctx);
+	bool (*grant_access)(void *ctx, struct device *dev, size_t addr,
+			     size_t size, enum dma_data_direction direction);
+	void (*revoke_access)(void *ctx, struct device *dev, size_t addr,
+			      size_t size, enum dma_data_direction direction);
+};
+
+int smaf_register_secure(struct smaf_secure *sec);
+void smaf_unregister_secure(struct smaf_secure *sec);
+
+/* the secure module registered, NULL if none */
+extern struct smaf_secure *kshim_smaf_secure;
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * tee_client_api.h
+ *
+ * GlobalPlatform TEE Client API, as far as the module uses it. The harness
+ * backend in teec.c calls the TA entry points directly.
+ *
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#ifndef _TEE_CLIENT_API_H_
+#define _TEE_CLIENT_API_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TEEC_Result;
+
+typedef struct {
+	uint32_t timeLow;
+	uint16_t timeMid;
+	uint16_t timeHiAndVersion;
+	uint8_t clockSeqAndNode[8];
+} TEEC_UUID;
+
+typedef struct {
+	int fd;
+} TEEC_Context;
+
+typedef struct {
+	TEEC_Context *ctx;
+	void *ta_session;
+} TEEC_Session;
+
+typedef struct {
+	void *buffer;
+	size_t size;
+	uint32_t flags;
+	int allocated;
+} TEEC_SharedMemory;
+
+typedef struct {
+	void *buffer;
+	size_t size;
+} TEEC_TempMemoryReference;
+
+typedef struct {
+	TEEC_SharedMemory *parent;
+	size_t size;
+	size_t offset;
+} TEEC_RegisteredMemoryReference;
+
+typedef struct {
+	uint32_t a;
+	uint32_t b;
+} TEEC_Value;
+
+typedef union {
+	TEEC_TempMemoryReference tmpref;
+	TEEC_RegisteredMemoryReference memref;
+	TEEC_Value value;
+} TEEC_Parameter;
+
+typedef struct {
+	uint32_t started;
+	uint32_t paramTypes;
+	TEEC_Parameter params[4];
+	TEEC_Session *session;
+} TEEC_Operation;
+
+#define TEEC_SUCCESS			0x00000000
+#define TEEC_ERROR_GENERIC		0xFFFF0000
+#define TEEC_ERROR_BAD_PARAMETERS	0xFFFF0006
+#define TEEC_ERROR_OUT_OF_MEMORY	0xFFFF000C
+#define TEEC_ERROR_COMMUNICATION	0xFFFF000E
+
+#define TEEC_ORIGIN_API			0x00000001
+#define TEEC_ORIGIN_TRUSTED_APP		0x00000004
+
+#define TEEC_NONE			0x00000000
+#define TEEC_VALUE_INPUT		0x00000001
+#define TEEC_VALUE_OUTPUT		0x00000002
+#define TEEC_VALUE_INOUT		0x00000003
+#define TEEC_MEMREF_TEMP_INPUT		0x00000005
+#define TEEC_MEMREF_TEMP_OUTPUT		0x00000006
+#define TEEC_MEMREF_TEMP_INOUT		0x00000007
+#define TEEC_MEMREF_WHOLE		0x0000000C
+#define TEEC_MEMREF_PARTIAL_INPUT	0x0000000D
+#define TEEC_MEMREF_PARTIAL_OUTPUT	0x0000000E
+#define TEEC_MEMREF_PARTIAL_INOUT	0x0000000F
+
+#define TEEC_MEM_INPUT			0x00000001
+#define TEEC_MEM_OUTPUT			0x00000002
+
+#define TEEC_LOGIN_PUBLIC		0x00000000
+
+#define TEEC_PARAM_TYPES(p0, p1, p2, p3) \
+	((p0) | ((p1) << 4) | ((p2) << 8) | ((p3) << 12))
+
+TEEC_Result TEEC_InitializeContext(const char *name, TEEC_Context *context);
+void TEEC_FinalizeContext(TEEC_Context *context);
+TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session,
+			     const TEEC_UUID *destination,
+			     uint32_t connection_method,
+			     const void *connection_data,
+			     TEEC_Operation *operation,
+			     uint32_t *return_origin);
+void TEEC_CloseSession(TEEC_Session *session);
+TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t cmd_id,
+			       TEEC_Operation *operation,
+			       uint32_t *return_origin);
+TEEC_Result TEEC_RegisterSharedMemory(TEEC_Context *context,
+				      TEEC_SharedMemory *shared_mem);
+TEEC_Result TEEC_AllocateSharedMemory(TEEC_Context *context,
+				      TEEC_SharedMemory *shared_mem);
+void TEEC_ReleaseSharedMemory(TEEC_SharedMemory *shared_mem);
+
+#endif
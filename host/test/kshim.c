@@ -0,0 +1,1113 @@
+/*
+ * kshim.c
+ *
+ * Userspace implementation of the kernel interfaces of kshim.h.
+ *
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/smaf-secure.h>
+
+#include "kshim.h"
+
+/* printk, errors and warnings by default */
+int kshim_loglevel = 4;
+
+unsigned long kshim_errors;
+unsigned long kshim_expected_errors;
+static __thread bool expect_errors;
+
+void kshim_expect_errors(bool expect)
+{
+	expect_errors = expect;
+}
+
+int printk(const char *fmt, ...)
+{
+	va_list args;
+	int level = 4, ret;
+
+	if (fmt[0] == '<' && fmt[1] >= '0' && fmt[1] <= '7' && fmt[2] == '>') {
+		level = fmt[1] - '0';
+		fmt += 3;
+	}
+
+	if (level <= 3 && expect_errors) {
+		__atomic_add_fetch(&kshim_expected_errors, 1, __ATOMIC_RELAXED);
+		level = 7;
+	} else if (level <= 3) {
+		__atomic_add_fetch(&kshim_errors, 1, __ATOMIC_RELAXED);
+	}
+
+	if (level > kshim_loglevel)
+		return 0;
+
+	va_start(args, fmt);
+	ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+
+	return ret;
+}
+
+size_t strlcpy(char *dest, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size) {
+		size_t n = len >= size ? size - 1 : len;
+
+		memcpy(dest, src, n);
+		dest[n] = '\0';
+	}
+
+	return len;
+}
+
+unsigned long copy_from_user(void *to, const void __user *from,
+			     unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+int num_online_cpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+int raw_smp_processor_id(void)
+{
+	int cpu = sched_getcpu();
+
+	return cpu >= 0 && cpu < num_online_cpus() ? cpu : 0;
+}
+
+/* time */
+ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ktime_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void deadline_after(struct timespec *ts, ktime_t ns)
+{
+	ktime_t t = ktime_get() + ns;
+
+	ts->tv_sec = t / NSEC_PER_SEC;
+	ts->tv_nsec = t % NSEC_PER_SEC;
+}
+
+void msleep(unsigned int ms)
+{
+	usleep(ms * 1000);
+}
+
+void usleep_range(unsigned long min, unsigned long max)
+{
+	(void)max;
+	usleep(min);
+}
+
+static void cond_init_monotonic(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* wait queues and completions */
+void init_waitqueue_head(wait_queue_head_t *wq)
+{
+	pthread_mutex_init(&wq->lock, NULL);
+	cond_init_monotonic(&wq->cond);
+}
+
+void wake_up(wait_queue_head_t *wq)
+{
+	pthread_mutex_lock(&wq->lock);
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+void __wait_timeout(wait_queue_head_t *wq, unsigned int ms)
+{
+	struct timespec ts;
+
+	deadline_after(&ts, (ktime_t)ms * NSEC_PER_MSEC);
+	pthread_cond_timedwait(&wq->cond, &wq->lock, &ts);
+}
+
+void init_completion(struct completion *x)
+{
+	x->done = 0;
+	init_waitqueue_head(&x->wait);
+}
+
+void reinit_completion(struct completion *x)
+{
+	x->done = 0;
+}
+
+void complete(struct completion *x)
+{
+	pthread_mutex_lock(&x->wait.lock);
+	if (x->done != UINT_MAX)
+		x->done++;
+	pthread_cond_broadcast(&x->wait.cond);
+	pthread_mutex_unlock(&x->wait.lock);
+}
+
+void complete_all(struct completion *x)
+{
+	pthread_mutex_lock(&x->wait.lock);
+	x->done = UINT_MAX;
+	pthread_cond_broadcast(&x->wait.cond);
+	pthread_mutex_unlock(&x->wait.lock);
+}
+
+void wait_for_completion(struct completion *x)
+{
+	pthread_mutex_lock(&x->wait.lock);
+	while (!x->done)
+		pthread_cond_wait(&x->wait.cond, &x->wait.lock);
+	if (x->done != UINT_MAX)
+		x->done--;
+	pthread_mutex_unlock(&x->wait.lock);
+}
+
+bool completion_done(struct completion *x)
+{
+	bool done;
+
+	pthread_mutex_lock(&x->wait.lock);
+	done = x->done != 0;
+	pthread_mutex_unlock(&x->wait.lock);
+
+	return done;
+}
+
+/*
+ * RCU: a reader counter is odd inside a read section, a grace period waits
+ * for the counters seen odd to move.
+ */
+struct rcu_reader {
+	unsigned long ctr;
+	int nesting;
+	struct rcu_reader *next;
+};
+
+static __thread struct rcu_reader *rcu_self;
+static struct rcu_reader *rcu_readers;
+static pthread_mutex_t rcu_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rcu_reader *rcu_reader_get(void)
+{
+	struct rcu_reader *r = rcu_self;
+
+	if (r)
+		return r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		abort();
+
+	pthread_mutex_lock(&rcu_readers_lock);
+	r->next = rcu_readers;
+	rcu_readers = r;
+	pthread_mutex_unlock(&rcu_readers_lock);
+
+	rcu_self = r;
+	return r;
+}
+
+void rcu_read_lock(void)
+{
+	struct rcu_reader *r = rcu_reader_get();
+
+	if (r->nesting++)
+		return;
+
+	__atomic_store_n(&r->ctr, r->ctr + 1, __ATOMIC_RELAXED);
+	smp_mb();
+}
+
+void rcu_read_unlock(void)
+{
+	struct rcu_reader *r = rcu_self;
+
+	if (--r->nesting)
+		return;
+
+	__atomic_store_n(&r->ctr, r->ctr + 1, __ATOMIC_RELEASE);
+}
+
+void synchronize_rcu(void)
+{
+	struct rcu_reader *r;
+	unsigned long ctr;
+
+	smp_mb();
+
+	pthread_mutex_lock(&rcu_readers_lock);
+	for (r = rcu_readers; r; r = r->next) {
+		ctr = __atomic_load_n(&r->ctr, __ATOMIC_ACQUIRE);
+		if (!(ctr & 1))
+			continue;
+		while (__atomic_load_n(&r->ctr, __ATOMIC_ACQUIRE) == ctr)
+			sched_yield();
+	}
+	pthread_mutex_unlock(&rcu_readers_lock);
+
+	smp_mb();
+}
+
+static struct rcu_head *rcu_pending;
+static unsigned long rcu_queued;
+static unsigned long rcu_done;
+static pthread_mutex_t rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rcu_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t rcu_once = PTHREAD_ONCE_INIT;
+
+static void *rcu_reclaim_thread(void *arg)
+{
+	struct rcu_head *list, *head;
+	unsigned long n;
+
+	(void)arg;
+
+	pthread_mutex_lock(&rcu_lock);
+	while (true) {
+		while (!rcu_pending)
+			pthread_cond_wait(&rcu_cond, &rcu_lock);
+
+		list = rcu_pending;
+		rcu_pending = NULL;
+		pthread_mutex_unlock(&rcu_lock);
+
+		synchronize_rcu();
+
+		for (n = 0; list; n++) {
+			head = list;
+			list = head->next;
+			/* small values are the offset of the head, kfree_rcu() */
+			if ((unsigned long)head->func < 4096)
+				free((char *)head - (unsigned long)head->func);
+			else
+				head->func(head);
+		}
+
+		pthread_mutex_lock(&rcu_lock);
+		rcu_done += n;
+		pthread_cond_broadcast(&rcu_cond);
+	}
+
+	return NULL;
+}
+
+static void rcu_start(void)
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, rcu_reclaim_thread, NULL))
+		abort();
+	pthread_detach(thread);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	pthread_once(&rcu_once, rcu_start);
+
+	head->func = func;
+
+	pthread_mutex_lock(&rcu_lock);
+	head->next = rcu_pending;
+	rcu_pending = head;
+	rcu_queued++;
+	pthread_cond_broadcast(&rcu_cond);
+	pthread_mutex_unlock(&rcu_lock);
+}
+
+void rcu_barrier(void)
+{
+	unsigned long target;
+
+	pthread_mutex_lock(&rcu_lock);
+	target = rcu_queued;
+	while (rcu_done < target)
+		pthread_cond_wait(&rcu_cond, &rcu_lock);
+	pthread_mutex_unlock(&rcu_lock);
+}
+
+/* treap standing for the rbtree, a node priority is a hash of its address */
+static unsigned long rb_hash(const struct rb_node *node)
+{
+	unsigned long x = (unsigned long)node;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+
+	return x;
+}
+
+static void rb_rotate_up(struct rb_node *node, struct rb_root *root,
+			 void (*update)(struct rb_node *node))
+{
+	struct rb_node *parent = node->rb_parent;
+	struct rb_node *grand = parent->rb_parent;
+
+	if (parent->rb_left == node) {
+		parent->rb_left = node->rb_right;
+		if (node->rb_right)
+			node->rb_right->rb_parent = parent;
+		node->rb_right = parent;
+	} else {
+		parent->rb_right = node->rb_left;
+		if (node->rb_left)
+			node->rb_left->rb_parent = parent;
+		node->rb_left = parent;
+	}
+
+	parent->rb_parent = node;
+	node->rb_parent = grand;
+
+	if (!grand)
+		root->rb_node = node;
+	else if (grand->rb_left == parent)
+		grand->rb_left = node;
+	else
+		grand->rb_right = node;
+
+	update(parent);
+	update(node);
+}
+
+void rb_treap_insert(struct rb_node *node, struct rb_node *parent,
+		     struct rb_node **link, struct rb_root *root,
+		     void (*update)(struct rb_node *node))
+{
+	node->rb_parent = parent;
+	node->rb_left = NULL;
+	node->rb_right = NULL;
+	node->rb_priority = rb_hash(node);
+	*link = node;
+
+	update(node);
+
+	while (node->rb_parent &&
+	       node->rb_parent->rb_priority > node->rb_priority)
+		rb_rotate_up(node, root, update);
+
+	for (parent = node->rb_parent; parent; parent = parent->rb_parent)
+		update(parent);
+}
+
+void rb_treap_erase(struct rb_node *node, struct rb_root *root,
+		    void (*update)(struct rb_node *node))
+{
+	struct rb_node *child, *parent;
+
+	/* sink the node to a leaf */
+	while (node->rb_left || node->rb_right) {
+		if (!node->rb_left)
+			child = node->rb_right;
+		else if (!node->rb_right)
+			child = node->rb_left;
+		else if (node->rb_left->rb_priority < node->rb_right->rb_priority)
+			child = node->rb_left;
+		else
+			child = node->rb_right;
+
+		rb_rotate_up(child, root, update);
+	}
+
+	parent = node->rb_parent;
+	if (!parent)
+		root->rb_node = NULL;
+	else if (parent->rb_left == node)
+		parent->rb_left = NULL;
+	else
+		parent->rb_right = NULL;
+
+	for (; parent; parent = parent->rb_parent)
+		update(parent);
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_left)
+		node = node->rb_left;
+
+	return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+
+	return parent;
+}
+
+static struct rb_node *rb_left_deepest(const struct rb_node *node)
+{
+	while (true) {
+		if (node->rb_left)
+			node = node->rb_left;
+		else if (node->rb_right)
+			node = node->rb_right;
+		else
+			return (struct rb_node *)node;
+	}
+}
+
+struct rb_node *rb_first_postorder(const struct rb_root *root)
+{
+	if (!root->rb_node)
+		return NULL;
+
+	return rb_left_deepest(root->rb_node);
+}
+
+struct rb_node *rb_next_postorder(const struct rb_node *node)
+{
+	const struct rb_node *parent;
+
+	if (!node)
+		return NULL;
+
+	parent = node->rb_parent;
+	if (parent && node == parent->rb_left && parent->rb_right)
+		return rb_left_deepest(parent->rb_right);
+
+	return (struct rb_node *)parent;
+}
+
+/*
+ * Workqueues: a work is queued once until it starts, and never runs on two
+ * workers at the same time. Delayed works wait in the timer list of their
+ * queue. One lock covers all the queues.
+ */
+#define WQ_MAX_WORKERS	8
+
+struct worker {
+	pthread_t thread;
+	struct workqueue_struct *wq;
+	struct work_struct *current_work;
+};
+
+struct workqueue_struct {
+	struct list_head works;
+	struct list_head timers;
+	struct list_head node;
+	struct worker workers[WQ_MAX_WORKERS];
+	int nr_workers;
+	bool stop;
+};
+
+struct workqueue_struct *system_wq;
+struct workqueue_struct *system_unbound_wq;
+
+static pthread_mutex_t wq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wq_cond;
+static LIST_HEAD(wq_list);
+
+static bool work_running(struct work_struct *work)
+{
+	struct workqueue_struct *wq;
+	int i;
+
+	list_for_each_entry(wq, &wq_list, node)
+		for (i = 0; i < wq->nr_workers; i++)
+			if (wq->workers[i].current_work == work)
+				return true;
+
+	return false;
+}
+
+/* first queued work not running elsewhere, timers expired first */
+static struct work_struct *wq_next(struct workqueue_struct *wq,
+				   ktime_t *deadline)
+{
+	struct work_struct *work, *tmp;
+	unsigned long now = jiffies;
+
+	list_for_each_entry_safe(work, tmp, &wq->timers, entry) {
+		if ((long)(work->expires - now) <= 0) {
+			list_del(&work->entry);
+			work->timer = false;
+			list_add_tail(&work->entry, &wq->works);
+		} else if ((ktime_t)(work->expires - now) * NSEC_PER_MSEC <
+			   *deadline) {
+			*deadline = (ktime_t)(work->expires - now) *
+				    NSEC_PER_MSEC;
+		}
+	}
+
+	list_for_each_entry(work, &wq->works, entry)
+		if (!work_running(work))
+			return work;
+
+	return NULL;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *worker = arg;
+	struct workqueue_struct *wq = worker->wq;
+	struct work_struct *work;
+	struct timespec ts;
+	ktime_t deadline;
+
+	pthread_mutex_lock(&wq_lock);
+	while (!wq->stop) {
+		deadline = 100 * NSEC_PER_MSEC;
+		work = wq_next(wq, &deadline);
+		if (!work) {
+			deadline_after(&ts, deadline);
+			pthread_cond_timedwait(&wq_cond, &wq_lock, &ts);
+			continue;
+		}
+
+		list_del_init(&work->entry);
+		work->pending = false;
+		worker->current_work = work;
+		pthread_mutex_unlock(&wq_lock);
+
+		/* the work may free itself, it isn't touched after */
+		work->func(work);
+
+		pthread_mutex_lock(&wq_lock);
+		worker->current_work = NULL;
+		pthread_cond_broadcast(&wq_cond);
+	}
+	pthread_mutex_unlock(&wq_lock);
+
+	return NULL;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					 int max_active, ...)
+{
+	struct workqueue_struct *wq;
+	int i;
+
+	(void)fmt;
+	(void)flags;
+
+	wq = calloc(1, sizeof(*wq));
+	if (!wq)
+		return NULL;
+
+	INIT_LIST_HEAD(&wq->works);
+	INIT_LIST_HEAD(&wq->timers);
+	wq->nr_workers = max_active > 0 && max_active < WQ_MAX_WORKERS ?
+			 max_active : WQ_MAX_WORKERS;
+
+	pthread_mutex_lock(&wq_lock);
+	list_add_tail(&wq->node, &wq_list);
+	for (i = 0; i < wq->nr_workers; i++) {
+		wq->workers[i].wq = wq;
+		if (pthread_create(&wq->workers[i].thread, NULL, worker_thread,
+				   &wq->workers[i]))
+			abort();
+	}
+	pthread_mutex_unlock(&wq_lock);
+
+	return wq;
+}
+
+void flush_workqueue(struct workqueue_struct *wq)
+{
+	int i;
+
+	pthread_mutex_lock(&wq_lock);
+	while (true) {
+		bool busy = !list_empty(&wq->works);
+
+		for (i = 0; i < wq->nr_workers; i++)
+			busy |= wq->workers[i].current_work != NULL;
+		if (!busy)
+			break;
+		pthread_cond_wait(&wq_cond, &wq_lock);
+	}
+	pthread_mutex_unlock(&wq_lock);
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	int i;
+
+	flush_workqueue(wq);
+
+	pthread_mutex_lock(&wq_lock);
+	wq->stop = true;
+	pthread_cond_broadcast(&wq_cond);
+	pthread_mutex_unlock(&wq_lock);
+
+	for (i = 0; i < wq->nr_workers; i++)
+		pthread_join(wq->workers[i].thread, NULL);
+
+	pthread_mutex_lock(&wq_lock);
+	list_del(&wq->node);
+	pthread_mutex_unlock(&wq_lock);
+
+	free(wq);
+}
+
+static void __queue_work(struct workqueue_struct *wq, struct work_struct *work,
+			 unsigned long delay)
+{
+	work->pending = true;
+	work->wq = wq;
+
+	if (delay) {
+		work->timer = true;
+		work->expires = jiffies + delay;
+		list_add_tail(&work->entry, &wq->timers);
+	} else {
+		list_add_tail(&work->entry, &wq->works);
+	}
+
+	pthread_cond_broadcast(&wq_cond);
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	bool queued = false;
+
+	pthread_mutex_lock(&wq_lock);
+	if (!work->pending) {
+		__queue_work(wq, work, 0);
+		queued = true;
+	}
+	pthread_mutex_unlock(&wq_lock);
+
+	return queued;
+}
+
+bool queue_delayed_work(struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay)
+{
+	bool queued = false;
+
+	pthread_mutex_lock(&wq_lock);
+	if (!dwork->work.pending) {
+		__queue_work(wq, &dwork->work, delay);
+		queued = true;
+	}
+	pthread_mutex_unlock(&wq_lock);
+
+	return queued;
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork,
+		      unsigned long delay)
+{
+	bool pending;
+
+	pthread_mutex_lock(&wq_lock);
+	pending = dwork->work.pending;
+	if (pending)
+		list_del(&dwork->work.entry);
+	dwork->work.timer = false;
+	__queue_work(wq, &dwork->work, delay);
+	pthread_mutex_unlock(&wq_lock);
+
+	return pending;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	bool pending;
+
+	pthread_mutex_lock(&wq_lock);
+	pending = work->pending;
+	if (pending) {
+		list_del_init(&work->entry);
+		work->pending = false;
+		work->timer = false;
+	}
+	while (work_running(work))
+		pthread_cond_wait(&wq_cond, &wq_lock);
+	pthread_mutex_unlock(&wq_lock);
+
+	return pending;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	return cancel_work_sync(&dwork->work);
+}
+
+bool flush_work(struct work_struct *work)
+{
+	bool waited = false;
+
+	pthread_mutex_lock(&wq_lock);
+	while (work->pending || work_running(work)) {
+		waited = true;
+		pthread_cond_wait(&wq_cond, &wq_lock);
+	}
+	pthread_mutex_unlock(&wq_lock);
+
+	return waited;
+}
+
+__attribute__((constructor))
+static void kshim_init(void)
+{
+	cond_init_monotonic(&wq_cond);
+	system_wq = alloc_workqueue("events", 0, 0);
+	system_unbound_wq = alloc_workqueue("events_unbound", WQ_UNBOUND, 0);
+}
+
+/* seq_file */
+int single_open(struct file *file, int (*show)(struct seq_file *m, void *v),
+		void *data)
+{
+	struct seq_file *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return -ENOMEM;
+
+	m->show = show;
+	m->private = data;
+	file->private_data = m;
+
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	(void)inode;
+
+	free(m->buf);
+	free(m);
+
+	return 0;
+}
+
+static void seq_vprintf(struct seq_file *m, const char *fmt, va_list args)
+{
+	va_list copy;
+	int len;
+
+	va_copy(copy, args);
+	len = vsnprintf(NULL, 0, fmt, copy);
+	va_end(copy);
+
+	if (len < 0)
+		return;
+
+	if (m->count + len + 1 > m->size) {
+		size_t size = (m->count + len + 1) * 2;
+		char *buf = realloc(m->buf, size);
+
+		if (!buf)
+			return;
+		m->buf = buf;
+		m->size = size;
+	}
+
+	vsnprintf(m->buf + m->count, m->size - m->count, fmt, args);
+	m->count += len;
+}
+
+void seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	seq_vprintf(m, fmt, args);
+	va_end(args);
+}
+
+void seq_puts(struct seq_file *m, const char *s)
+{
+	seq_printf(m, "%s", s);
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t count,
+		 loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+
+	if (!m->buf && m->show(m, NULL))
+		return -EINVAL;
+
+	return simple_read_from_buffer(buf, count, ppos, m->buf, m->count);
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+	return default_llseek(file, offset, whence);
+}
+
+loff_t default_llseek(struct file *file, loff_t offset, int whence)
+{
+	if (whence != SEEK_SET || offset < 0)
+		return -EINVAL;
+
+	file->f_pos = offset;
+	return offset;
+}
+
+loff_t no_llseek(struct file *file, loff_t offset, int whence)
+{
+	(void)file;
+	(void)offset;
+	(void)whence;
+
+	return -ESPIPE;
+}
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+				const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if ((size_t)pos >= available || !count)
+		return 0;
+	if (count > available - pos)
+		count = available - pos;
+
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+
+	return count;
+}
+
+/* debugfs, a flat list of the entries created */
+struct dentry {
+	char name[64];
+	struct dentry *parent;
+	void *data;
+	const struct file_operations *fops;
+	struct dentry *next;
+};
+
+static struct dentry *debugfs_entries;
+static pthread_mutex_t debugfs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops)
+{
+	struct dentry *dentry = calloc(1, sizeof(*dentry));
+
+	(void)mode;
+
+	if (!dentry)
+		return NULL;
+
+	strlcpy(dentry->name, name, sizeof(dentry->name));
+	dentry->parent = parent;
+	dentry->data = data;
+	dentry->fops = fops;
+
+	pthread_mutex_lock(&debugfs_lock);
+	dentry->next = debugfs_entries;
+	debugfs_entries = dentry;
+	pthread_mutex_unlock(&debugfs_lock);
+
+	return dentry;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return debugfs_create_file(name, 0, parent, NULL, NULL);
+}
+
+static bool dentry_below(const struct dentry *dentry,
+			 const struct dentry *root)
+{
+	for (; dentry; dentry = dentry->parent)
+		if (dentry == root)
+			return true;
+
+	return false;
+}
+
+void debugfs_remove_recursive(struct dentry *root)
+{
+	struct dentry **link, *dentry, *removed = NULL;
+
+	if (!root)
+		return;
+
+	/* the parents are freed last, the children still point to them */
+	pthread_mutex_lock(&debugfs_lock);
+	link = &debugfs_entries;
+	while ((dentry = *link)) {
+		if (dentry_below(dentry, root)) {
+			*link = dentry->next;
+			dentry->next = removed;
+			removed = dentry;
+		} else {
+			link = &dentry->next;
+		}
+	}
+	pthread_mutex_unlock(&debugfs_lock);
+
+	while (removed) {
+		dentry = removed;
+		removed = dentry->next;
+		free(dentry);
+	}
+}
+
+static struct dentry *debugfs_lookup_file(const char *name)
+{
+	struct dentry *dentry;
+
+	pthread_mutex_lock(&debugfs_lock);
+	for (dentry = debugfs_entries; dentry; dentry = dentry->next)
+		if (dentry->fops && !strcmp(dentry->name, name))
+			break;
+	pthread_mutex_unlock(&debugfs_lock);
+
+	return dentry;
+}
+
+ssize_t kshim_debugfs_read(const char *name, char *buf, size_t size)
+{
+	struct dentry *dentry = debugfs_lookup_file(name);
+	struct inode inode = { NULL };
+	struct file file = { NULL, 0 };
+	size_t count = 0;
+	ssize_t ret;
+
+	if (!dentry || !dentry->fops->read || !size)
+		return -1;
+
+	inode.i_private = dentry->data;
+	file.private_data = dentry->data;
+	if (dentry->fops->open && dentry->fops->open(&inode, &file))
+		return -1;
+
+	while (count < size - 1) {
+		ret = dentry->fops->read(&file, buf + count, size - 1 - count,
+					 &file.f_pos);
+		if (ret <= 0)
+			break;
+		count += ret;
+	}
+	buf[count] = '\0';
+
+	if (dentry->fops->release)
+		dentry->fops->release(&inode, &file);
+
+	return count;
+}
+
+ssize_t kshim_debugfs_write(const char *name, const char *buf, size_t size)
+{
+	struct dentry *dentry = debugfs_lookup_file(name);
+	struct inode inode = { NULL };
+	struct file file = { NULL, 0 };
+	ssize_t ret;
+
+	if (!dentry || !dentry->fops->write)
+		return -1;
+
+	inode.i_private = dentry->data;
+	file.private_data = dentry->data;
+	if (dentry->fops->open && dentry->fops->open(&inode, &file))
+		return -1;
+
+	ret = dentry->fops->write(&file, buf, size, &file.f_pos);
+
+	if (dentry->fops->release)
+		dentry->fops->release(&inode, &file);
+
+	return ret;
+}
+
+/* module parameters */
+#define MAX_PARAMS	32
+
+static struct {
+	const char *name;
+	void *value;
+	size_t size;
+} params[MAX_PARAMS];
+static int nr_params;
+
+void kshim_param_add(const char *name, void *value, size_t size)
+{
+	if (nr_params == MAX_PARAMS)
+		abort();
+
+	params[nr_params].name = name;
+	params[nr_params].value = value;
+	params[nr_params].size = size;
+	nr_params++;
+}
+
+int kshim_param_set(const char *name, unsigned int value)
+{
+	int i;
+
+	for (i = 0; i < nr_params; i++) {
+		if (strcmp(params[i].name, name))
+			continue;
+
+		if (params[i].size == sizeof(bool))
+			*(bool *)params[i].value = value != 0;
+		else
+			*(unsigned int *)params[i].value = value;
+		return 0;
+	}
+
+	return -1;
+}
+
+/* SMAF, the harness calls the registered secure module */
+struct smaf_secure *kshim_smaf_secure;
+
+int smaf_register_secure(struct smaf_secure *sec)
+{
+	kshim_smaf_secure = sec;
+	return 0;
+}
+
+void smaf_unregister_secure(struct smaf_secure *sec)
+{
+	if (kshim_smaf_secure == sec)
+		kshim_smaf_secure = NULL;
+}
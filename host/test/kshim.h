@@ -0,0 +1,990 @@
+/*
+ * kshim.h
+ *
+ * Userspace stand-ins for the kernel interfaces used by smaf-optee.c, so the
+ * module can run in a process. Locks, RCU, seqcounts and workqueues are built
+ * on pthreads and keep the kernel semantics the module relies on; the rest
+ * is the minimum to build.
+ *
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#ifndef _KSHIM_H_
+#define _KSHIM_H_
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* types */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef long long s64;
+typedef unsigned int gfp_t;
+typedef u64 dma_addr_t;
+typedef unsigned short umode_t;
+
+#define GFP_KERNEL	0
+#define GFP_ATOMIC	1
+#define GFP_NOWAIT	2
+
+#define __init
+#define __exit
+#define __user
+#define __rcu
+#define __must_check
+
+#define EPERM		1
+#define ENOENT		2
+#define EIO		5
+#define E2BIG		7
+#define EAGAIN		11
+#define ENOMEM		12
+#define EACCES		13
+#define EFAULT		14
+#define EBUSY		16
+#define EEXIST		17
+#define ENODEV		19
+#define EINVAL		22
+#define ENOSPC		28
+#define ESPIPE		29
+#define ETIMEDOUT	110
+
+#define S_IRUGO		0444
+#define S_IWUSR		0200
+
+#define BITS_PER_LONG	64
+#define UINT_MAX	(~0U)
+#define U32_MAX		((u32)~0U)
+#define U64_MAX		((u64)~0ULL)
+#define BIT(n)		(1UL << (n))
+
+#define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
+#define min(a, b)	((a) < (b) ? (a) : (b))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)	((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)	((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, lo, hi)	min_t(t, max_t(t, v, lo), hi)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define upper_32_bits(n)	((u32)(((n) >> 16) >> 16))
+#define lower_32_bits(n)	((u32)(n))
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+#define WARN_ON(x) ({							\
+	int __ret = !!(x);						\
+	if (__ret)							\
+		fprintf(stderr, "WARNING at %s:%d\n", __FILE__, __LINE__); \
+	__ret;								\
+})
+#define WARN_ON_ONCE(x)	WARN_ON(x)
+#define BUG_ON(x)	do { if (x) abort(); } while (0)
+#define BUILD_BUG_ON(x)	((void)sizeof(char[1 - 2 * !!(x)]))
+
+#define IS_ERR(x)	((unsigned long)(x) >= (unsigned long)-4095)
+#define PTR_ERR(x)	((long)(x))
+#define ERR_PTR(x)	((void *)(long)(x))
+
+/* log2 */
+#define ilog2(n)	(63 - __builtin_clzll(n))
+#define is_power_of_2(n)	((n) != 0 && (((n) & ((n) - 1)) == 0))
+#define roundup_pow_of_two(n) \
+	((n) <= 1 ? 1UL : 1UL << (64 - __builtin_clzll((n) - 1)))
+
+static inline u64 div_u64(u64 a, u32 b)
+{
+	return a / b;
+}
+
+static inline u64 div64_u64(u64 a, u64 b)
+{
+	return a / b;
+}
+
+/* printk */
+#define KERN_ERR	"<3>"
+#define KERN_WARNING	"<4>"
+#define KERN_INFO	"<6>"
+#define KERN_DEBUG	"<7>"
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * errors a test provokes on purpose: while the calling thread expects them,
+ * its KERN_ERR messages are counted in kshim_expected_errors and shown at
+ * KERN_DEBUG level, the other ones are counted in kshim_errors
+ */
+void kshim_expect_errors(bool expect);
+extern unsigned long kshim_errors;
+extern unsigned long kshim_expected_errors;
+
+#define pr_err(...)	printk(KERN_ERR __VA_ARGS__)
+#define pr_warn(...)	printk(KERN_WARNING __VA_ARGS__)
+#define pr_info(...)	printk(KERN_INFO __VA_ARGS__)
+#define pr_debug(...)	do { } while (0)
+
+/* memory */
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	(void)flags;
+	return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	(void)flags;
+	return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+	(void)flags;
+	return calloc(n, size);
+}
+
+static inline void *krealloc(const void *p, size_t size, gfp_t flags)
+{
+	(void)flags;
+	return realloc((void *)p, size);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+static inline void *vmalloc(unsigned long size)
+{
+	return malloc(size);
+}
+
+static inline void *vzalloc(unsigned long size)
+{
+	return calloc(1, size);
+}
+
+static inline void vfree(const void *p)
+{
+	free((void *)p);
+}
+
+size_t strlcpy(char *dest, const char *src, size_t size);
+
+static inline char *kstrdup(const char *s, gfp_t flags)
+{
+	(void)flags;
+	return s ? strdup(s) : NULL;
+}
+
+unsigned long copy_from_user(void *to, const void __user *from,
+			     unsigned long n);
+unsigned long copy_to_user(void __user *to, const void *from,
+			   unsigned long n);
+
+/* barriers and atomics */
+#define smp_mb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()		__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()		__atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_mb__after_atomic()	smp_mb()
+#define smp_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+
+#define ATOMIC_INIT(i)	{ (i) }
+
+#define atomic_read(v)		__atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i)	__atomic_store_n(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic_inc(v)		((void)__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_dec(v)		((void)__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_inc_return(v)	__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_return(v)	__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_and_test(v)	(atomic_dec_return(v) == 0)
+
+#define atomic64_read(v)	__atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic64_set(v, i)	__atomic_store_n(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic64_inc(v)		((void)__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic64_add(i, v)	((void)__atomic_add_fetch(&(v)->counter, i, __ATOMIC_SEQ_CST))
+#define atomic64_inc_return(v)	__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+
+#define test_and_set_bit_lock(nr, addr) \
+	((__atomic_fetch_or(addr, 1UL << (nr), __ATOMIC_ACQUIRE) >> (nr)) & 1)
+#define clear_bit_unlock(nr, addr) \
+	((void)__atomic_fetch_and(addr, ~(1UL << (nr)), __ATOMIC_RELEASE))
+#define test_bit(nr, addr) \
+	((__atomic_load_n(addr, __ATOMIC_RELAXED) >> (nr)) & 1)
+
+/* cpus */
+int num_online_cpus(void);
+int raw_smp_processor_id(void);
+
+/* locks */
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define DEFINE_MUTEX(name) \
+	struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+
+static inline void mutex_init(struct mutex *m)
+{
+	pthread_mutex_init(&m->lock, NULL);
+}
+
+static inline void mutex_lock(struct mutex *m)
+{
+	pthread_mutex_lock(&m->lock);
+}
+
+static inline int mutex_trylock(struct mutex *m)
+{
+	return pthread_mutex_trylock(&m->lock) == 0;
+}
+
+static inline void mutex_unlock(struct mutex *m)
+{
+	pthread_mutex_unlock(&m->lock);
+}
+
+typedef struct mutex spinlock_t;
+
+#define DEFINE_SPINLOCK(name)	DEFINE_MUTEX(name)
+#define spin_lock_init(l)	mutex_init(l)
+#define spin_lock(l)		mutex_lock(l)
+#define spin_unlock(l)		mutex_unlock(l)
+#define spin_lock_bh(l)		mutex_lock(l)
+#define spin_unlock_bh(l)	mutex_unlock(l)
+#define spin_lock_irqsave(l, f)	do { (f) = 0; mutex_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) \
+	do { (void)(f); mutex_unlock(l); } while (0)
+
+/* seqcount, the writers are serialized by the caller */
+typedef struct {
+	unsigned int sequence;
+} seqcount_t;
+
+/* seqcount whose writers hold the mutex, checked like lockdep does */
+typedef struct {
+	seqcount_t seqcount;
+	struct mutex *lock;
+} seqcount_mutex_t;
+
+static inline void seqcount_init(seqcount_t *s)
+{
+	s->sequence = 0;
+}
+
+static inline void seqcount_mutex_init(seqcount_mutex_t *s, struct mutex *lock)
+{
+	seqcount_init(&s->seqcount);
+	s->lock = lock;
+}
+
+/* the writer must hold the mutex: it can't be taken */
+static inline void __seqcount_mutex_assert(const seqcount_mutex_t *s)
+{
+	if (mutex_trylock(s->lock)) {
+		mutex_unlock(s->lock);
+		abort();
+	}
+}
+
+static inline void __seqcount_assert(const seqcount_t *s)
+{
+}
+
+#define __seqcount_ptr(s)						\
+	_Generic(*(s),							\
+		 seqcount_t: (seqcount_t *)(s),				\
+		 seqcount_mutex_t: &((seqcount_mutex_t *)(s))->seqcount)
+
+#define __seqcount_lockdep_assert(s)					\
+	_Generic(*(s),							\
+		 seqcount_t: __seqcount_assert,				\
+		 seqcount_mutex_t: __seqcount_mutex_assert)(s)
+
+static inline unsigned int __read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+static inline int __read_seqcount_retry(const seqcount_t *s, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void __write_seqcount_begin(seqcount_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void __write_seqcount_end(seqcount_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+#define read_seqcount_begin(s)	__read_seqcount_begin(__seqcount_ptr(s))
+#define read_seqcount_retry(s, seq) \
+	__read_seqcount_retry(__seqcount_ptr(s), seq)
+#define write_seqcount_begin(s)						\
+	do {								\
+		__seqcount_lockdep_assert(s);				\
+		__write_seqcount_begin(__seqcount_ptr(s));		\
+	} while (0)
+#define write_seqcount_end(s)	__write_seqcount_end(__seqcount_ptr(s))
+
+/* kref */
+struct kref {
+	atomic_t refcount;
+};
+
+static inline void kref_init(struct kref *kref)
+{
+	atomic_set(&kref->refcount, 1);
+}
+
+static inline void kref_get(struct kref *kref)
+{
+	atomic_inc(&kref->refcount);
+}
+
+static inline int kref_get_unless_zero(struct kref *kref)
+{
+	int old = atomic_read(&kref->refcount);
+
+	do {
+		if (!old)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&kref->refcount.counter, &old,
+					      old + 1, false, __ATOMIC_SEQ_CST,
+					      __ATOMIC_RELAXED));
+
+	return 1;
+}
+
+static inline int kref_put(struct kref *kref,
+			   void (*release)(struct kref *kref))
+{
+	if (atomic_dec_and_test(&kref->refcount)) {
+		release(kref);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * RCU: each thread counts its outermost read sections, a grace period waits
+ * for every thread seen inside a read section to leave it. Callbacks run in
+ * a reclaim thread after a grace period.
+ */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void rcu_barrier(void);
+
+/* the offset of the rcu_head is passed as callback, as in the kernel */
+#define kfree_rcu(ptr, field) \
+	call_rcu(&(ptr)->field, \
+		 (void (*)(struct rcu_head *))offsetof(typeof(*(ptr)), field))
+
+#define rcu_dereference(p)	__atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	__atomic_store_n(&prev->next, new, __ATOMIC_RELEASE);
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next)
+{
+	next->prev = prev;
+	WRITE_ONCE(prev->next, next);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return READ_ONCE(head->next) == head;
+}
+
+#define list_add_rcu(new, head)	list_add(new, head)
+#define list_add_tail_rcu(new, head)	list_add_tail(new, head)
+
+/* readers may still walk through the entry, keep its next pointer */
+static inline void list_del_rcu(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	entry->prev = NULL;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member) \
+	list_entry((pos)->member.next, typeof(*(pos)), member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_first_entry(head, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_rcu(pos, head, member)			\
+	for (pos = list_entry(rcu_dereference((head)->next),		\
+			      typeof(*pos), member);			\
+	     &pos->member != (head);					\
+	     pos = list_entry(rcu_dereference(pos->member.next),	\
+			      typeof(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_first_entry(head, typeof(*pos), member),	\
+	     n = list_next_entry(pos, member);				\
+	     &pos->member != (head);					\
+	     pos = n, n = list_next_entry(n, member))
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del_init(struct hlist_node *n)
+{
+	if (!n->pprev)
+		return;
+
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+#define hlist_entry_safe(ptr, type, member) \
+	({ typeof(ptr) ____ptr = (ptr); \
+	   ____ptr ? container_of(____ptr, type, member) : NULL; })
+
+#define hlist_for_each_entry(pos, head, member)				\
+	for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member); \
+	     pos;							\
+	     pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
+
+#define hlist_for_each_entry_safe(pos, n, head, member)		\
+	for (pos = hlist_entry_safe((head)->first, typeof(*pos), member); \
+	     pos && ({ n = pos->member.next; 1; });			\
+	     pos = hlist_entry_safe(n, typeof(*pos), member))
+
+/* hashtable */
+#define DEFINE_HASHTABLE(name, bits) \
+	struct hlist_head name[1 << (bits)]
+#define DECLARE_HASHTABLE(name, bits) \
+	struct hlist_head name[1 << (bits)]
+
+#define HASH_SIZE(name)	(ARRAY_SIZE(name))
+#define HASH_BITS(name)	ilog2(HASH_SIZE(name))
+
+static inline u32 hash_64(u64 val, unsigned int bits)
+{
+	return (u32)((val * 0x61C8864680B583EBull) >> (64 - bits));
+}
+
+#define hash_min(val, bits)	hash_64((u64)(val), bits)
+
+#define hash_init(table)	memset(table, 0, sizeof(table))
+#define hash_add(table, node, key) \
+	hlist_add_head(node, &table[hash_min(key, HASH_BITS(table))])
+#define hash_del(node)		hlist_del_init(node)
+
+#define hash_for_each_possible(name, obj, member, key) \
+	hlist_for_each_entry(obj, &name[hash_min(key, HASH_BITS(name))], member)
+
+#define hash_for_each_safe(name, bkt, tmp, obj, member)			\
+	for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < HASH_SIZE(name); \
+	     (bkt)++)							\
+		hlist_for_each_entry_safe(obj, tmp, &name[bkt], member)
+
+/*
+ * rbtree: the nodes are kept in a treap, only the interval tree and the
+ * iterators of the module are provided
+ */
+struct rb_node {
+	struct rb_node *rb_parent;
+	struct rb_node *rb_left;
+	struct rb_node *rb_right;
+	unsigned long rb_priority;
+};
+
+struct rb_root {
+	struct rb_node *rb_node;
+};
+
+#define RB_ROOT		(struct rb_root) { NULL, }
+#define RB_EMPTY_ROOT(root)	((root)->rb_node == NULL)
+#define rb_entry(ptr, type, member)	container_of(ptr, type, member)
+#define rb_entry_safe(ptr, type, member) \
+	({ typeof(ptr) ____ptr = (ptr); \
+	   ____ptr ? rb_entry(____ptr, type, member) : NULL; })
+#define rb_parent(node)	((node)->rb_parent)
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_first_postorder(const struct rb_root *root);
+struct rb_node *rb_next_postorder(const struct rb_node *node);
+
+/* link a new node below parent and rotate it up to heap order */
+void rb_treap_insert(struct rb_node *node, struct rb_node *parent,
+		     struct rb_node **link, struct rb_root *root,
+		     void (*update)(struct rb_node *node));
+void rb_treap_erase(struct rb_node *node, struct rb_root *root,
+		    void (*update)(struct rb_node *node));
+
+#define rbtree_postorder_for_each_entry_safe(pos, n, root, field)	\
+	for (pos = rb_entry_safe(rb_first_postorder(root), typeof(*pos), field); \
+	     pos && ({ n = rb_entry_safe(rb_next_postorder(&pos->field), \
+			typeof(*pos), field); 1; });			\
+	     pos = n)
+
+#define INTERVAL_TREE_DEFINE(ITSTRUCT, ITRB, ITTYPE, ITSUBTREE,		      \
+			     ITSTART, ITLAST, ITSTATIC, ITPREFIX)	      \
+									      \
+static void ITPREFIX ## _update(struct rb_node *rb)			      \
+{									      \
+	ITSTRUCT *node = rb_entry(rb, ITSTRUCT, ITRB);			      \
+	ITTYPE max = ITLAST(node);					      \
+									      \
+	if (rb->rb_left &&						      \
+	    rb_entry(rb->rb_left, ITSTRUCT, ITRB)->ITSUBTREE > max)	      \
+		max = rb_entry(rb->rb_left, ITSTRUCT, ITRB)->ITSUBTREE;	      \
+	if (rb->rb_right &&						      \
+	    rb_entry(rb->rb_right, ITSTRUCT, ITRB)->ITSUBTREE > max)	      \
+		max = rb_entry(rb->rb_right, ITSTRUCT, ITRB)->ITSUBTREE;	      \
+	node->ITSUBTREE = max;						      \
+}									      \
+									      \
+ITSTATIC void ITPREFIX ## _insert(ITSTRUCT *node, struct rb_root *root)	      \
+{									      \
+	struct rb_node **link = &root->rb_node, *rb_parent = NULL;	      \
+	ITTYPE start = ITSTART(node);					      \
+	ITSTRUCT *parent;						      \
+									      \
+	while (*link) {							      \
+		rb_parent = *link;					      \
+		parent = rb_entry(rb_parent, ITSTRUCT, ITRB);		      \
+		if (start < ITSTART(parent))				      \
+			link = &parent->ITRB.rb_left;			      \
+		else							      \
+			link = &parent->ITRB.rb_right;			      \
+	}								      \
+									      \
+	node->ITSUBTREE = ITLAST(node);					      \
+	rb_treap_insert(&node->ITRB, rb_parent, link, root,		      \
+			ITPREFIX ## _update);				      \
+}									      \
+									      \
+ITSTATIC void ITPREFIX ## _remove(ITSTRUCT *node, struct rb_root *root)	      \
+{									      \
+	rb_treap_erase(&node->ITRB, root, ITPREFIX ## _update);		      \
+}									      \
+									      \
+static ITSTRUCT *							      \
+ITPREFIX ## _subtree_search(ITSTRUCT *node, ITTYPE start, ITTYPE last)	      \
+{									      \
+	while (true) {							      \
+		if (node->ITRB.rb_left) {				      \
+			ITSTRUCT *left = rb_entry(node->ITRB.rb_left,	      \
+						  ITSTRUCT, ITRB);	      \
+			if (start <= left->ITSUBTREE) {			      \
+				node = left;				      \
+				continue;				      \
+			}						      \
+		}							      \
+		if (ITSTART(node) <= last) {				      \
+			if (start <= ITLAST(node))			      \
+				return node;				      \
+			if (node->ITRB.rb_right) {			      \
+				node = rb_entry(node->ITRB.rb_right,	      \
+						ITSTRUCT, ITRB);	      \
+				if (start <= node->ITSUBTREE)		      \
+					continue;			      \
+			}						      \
+		}							      \
+		return NULL;						      \
+	}								      \
+}									      \
+									      \
+ITSTATIC ITSTRUCT *							      \
+ITPREFIX ## _iter_first(struct rb_root *root, ITTYPE start, ITTYPE last)     \
+{									      \
+	ITSTRUCT *node;							      \
+									      \
+	if (!root->rb_node)						      \
+		return NULL;						      \
+	node = rb_entry(root->rb_node, ITSTRUCT, ITRB);			      \
+	if (node->ITSUBTREE < start)					      \
+		return NULL;						      \
+	return ITPREFIX ## _subtree_search(node, start, last);		      \
+}									      \
+									      \
+ITSTATIC ITSTRUCT *							      \
+ITPREFIX ## _iter_next(ITSTRUCT *node, ITTYPE start, ITTYPE last)	      \
+{									      \
+	struct rb_node *rb = node->ITRB.rb_right, *prev;		      \
+									      \
+	while (true) {							      \
+		if (rb) {						      \
+			ITSTRUCT *right = rb_entry(rb, ITSTRUCT, ITRB);	      \
+			if (start <= right->ITSUBTREE)			      \
+				return ITPREFIX ## _subtree_search(right,     \
+								start, last); \
+		}							      \
+		do {							      \
+			rb = rb_parent(&node->ITRB);			      \
+			if (!rb)					      \
+				return NULL;				      \
+			prev = &node->ITRB;				      \
+			node = rb_entry(rb, ITSTRUCT, ITRB);		      \
+			rb = node->ITRB.rb_right;			      \
+		} while (prev == rb);					      \
+		if (last < ITSTART(node))				      \
+			return NULL;					      \
+		else if (start <= ITLAST(node))				      \
+			return node;					      \
+	}								      \
+}
+
+/* time */
+typedef s64 ktime_t;
+
+#define NSEC_PER_USEC	1000LL
+#define NSEC_PER_MSEC	1000000LL
+#define NSEC_PER_SEC	1000000000LL
+#define USEC_PER_MSEC	1000LL
+#define USEC_PER_SEC	1000000LL
+
+ktime_t ktime_get(void);
+
+static inline u64 ktime_get_ns(void)
+{
+	return ktime_get();
+}
+
+static inline s64 ktime_to_ns(ktime_t kt)
+{
+	return kt;
+}
+
+static inline s64 ktime_to_us(ktime_t kt)
+{
+	return kt / NSEC_PER_USEC;
+}
+
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b)
+{
+	return a - b;
+}
+
+static inline s64 ktime_us_delta(ktime_t later, ktime_t earlier)
+{
+	return (later - earlier) / NSEC_PER_USEC;
+}
+
+/* jiffies are milliseconds */
+#define HZ	1000
+#define jiffies	((unsigned long)(ktime_get() / NSEC_PER_MSEC))
+
+static inline unsigned long msecs_to_jiffies(unsigned int ms)
+{
+	return ms;
+}
+
+void msleep(unsigned int ms);
+void usleep_range(unsigned long min, unsigned long max);
+
+/* wait queues and completions */
+typedef struct wait_queue_head {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} wait_queue_head_t;
+
+void init_waitqueue_head(wait_queue_head_t *wq);
+void wake_up(wait_queue_head_t *wq);
+void __wait_timeout(wait_queue_head_t *wq, unsigned int ms);
+
+/* the condition is checked with the queue locked, wake_up() can't be lost */
+#define wait_event(wq, condition)					\
+do {									\
+	pthread_mutex_lock(&(wq).lock);					\
+	while (!(condition))						\
+		__wait_timeout(&(wq), 10);				\
+	pthread_mutex_unlock(&(wq).lock);				\
+} while (0)
+
+#define wake_up_all(wq)	wake_up(wq)
+
+struct completion {
+	unsigned int done;
+	wait_queue_head_t wait;
+};
+
+void init_completion(struct completion *x);
+void reinit_completion(struct completion *x);
+void complete(struct completion *x);
+void complete_all(struct completion *x);
+void wait_for_completion(struct completion *x);
+bool completion_done(struct completion *x);
+
+/* workqueues */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct workqueue_struct;
+
+struct work_struct {
+	struct list_head entry;
+	work_func_t func;
+	struct workqueue_struct *wq;
+	bool pending;
+	/* delayed, in the timer list until expires */
+	bool timer;
+	unsigned long expires;
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+#define INIT_WORK(w, f) \
+	do { memset(w, 0, sizeof(*(w))); (w)->func = (f); } while (0)
+#define INIT_DELAYED_WORK(w, f) \
+	do { memset(w, 0, sizeof(*(w))); (w)->work.func = (f); } while (0)
+#define to_delayed_work(w)	container_of(w, struct delayed_work, work)
+
+#define WQ_UNBOUND	(1 << 1)
+#define WQ_MEM_RECLAIM	(1 << 3)
+#define WQ_HIGHPRI	(1 << 4)
+
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_unbound_wq;
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					 int max_active, ...);
+#define alloc_ordered_workqueue(fmt, flags, ...) \
+	alloc_workqueue(fmt, flags, 1, ##__VA_ARGS__)
+void destroy_workqueue(struct workqueue_struct *wq);
+void flush_workqueue(struct workqueue_struct *wq);
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool queue_delayed_work(struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay);
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork,
+		      unsigned long delay);
+bool cancel_work_sync(struct work_struct *work);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+bool flush_work(struct work_struct *work);
+
+static inline bool schedule_work(struct work_struct *work)
+{
+	return queue_work(system_wq, work);
+}
+
+static inline bool schedule_delayed_work(struct delayed_work *dwork,
+					 unsigned long delay)
+{
+	return queue_delayed_work(system_wq, dwork, delay);
+}
+
+/* seq_file and debugfs, the files can be read back by the harness */
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	void *private_data;
+	loff_t f_pos;
+};
+
+struct seq_file {
+	char *buf;
+	size_t size;
+	size_t count;
+	int (*show)(struct seq_file *m, void *v);
+	void *private;
+};
+
+struct module;
+#define THIS_MODULE	((struct module *)NULL)
+
+struct file_operations {
+	struct module *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	ssize_t (*read)(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos);
+	ssize_t (*write)(struct file *file, const char __user *buf,
+			 size_t count, loff_t *ppos);
+	loff_t (*llseek)(struct file *file, loff_t offset, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+int single_open(struct file *file, int (*show)(struct seq_file *m, void *v),
+		void *data);
+int single_release(struct inode *inode, struct file *file);
+ssize_t seq_read(struct file *file, char __user *buf, size_t count,
+		 loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+void seq_printf(struct seq_file *m, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void seq_puts(struct seq_file *m, const char *s);
+loff_t no_llseek(struct file *file, loff_t offset, int whence);
+loff_t default_llseek(struct file *file, loff_t offset, int whence);
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+				const void *from, size_t available);
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+/* read a debugfs file of the module into buf, return its size or -1 */
+ssize_t kshim_debugfs_read(const char *name, char *buf, size_t size);
+/* write a debugfs file of the module, return the bytes taken or -1 */
+ssize_t kshim_debugfs_write(const char *name, const char *buf, size_t size);
+
+/* devices and DMA */
+struct device_driver {
+	const char *name;
+};
+
+struct device {
+	struct device_driver *driver;
+};
+
+enum dma_data_direction {
+	DMA_BIDIRECTIONAL = 0,
+	DMA_TO_DEVICE = 1,
+	DMA_FROM_DEVICE = 2,
+	DMA_NONE = 3,
+};
+
+struct scatterlist {
+	dma_addr_t dma_address;
+	unsigned int dma_length;
+};
+
+struct sg_table {
+	struct scatterlist *sgl;
+	unsigned int nents;
+	unsigned int orig_nents;
+};
+
+#define sg_dma_address(sg)	((sg)->dma_address)
+#define sg_dma_len(sg)		((sg)->dma_length)
+#define sg_next(sg)		((sg) + 1)
+#define for_each_sg(sglist, sg, nr, __i) \
+	for (__i = 0, sg = (sglist); __i < (nr); __i++, sg = sg_next(sg))
+
+/* module */
+#define module_init(fn)	int kshim_module_init(void) { return fn(); }
+#define module_exit(fn)	void kshim_module_exit(void) { fn(); }
+/* the parameters can be set by name before kshim_module_init() */
+#define module_param(name, type, perm)					\
+	__attribute__((constructor)) static void __kshim_param_##name(void) \
+	{								\
+		kshim_param_add(#name, &name, sizeof(name));		\
+	}
+#define MODULE_PARM_DESC(name, desc)
+#define MODULE_LICENSE(license)
+#define MODULE_DESCRIPTION(desc)
+#define MODULE_AUTHOR(author)
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+
+int kshim_module_init(void);
+void kshim_module_exit(void);
+
+void kshim_param_add(const char *name, void *value, size_t size);
+/* set a bool or uint parameter, return 0 or -1 if it doesn't exist */
+int kshim_param_set(const char *name, unsigned int value);
+
+#endif
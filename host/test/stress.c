@@ -0,0 +1,317 @@
+/*
+ * stress.c
+ *
+ * Run smaf-optee in a process against the TA core, with N threads each
+ * going through create context, grant, revoke and destroy context on its
+ * own buffers. The run fails if a grant of the decode and display flow is
+ * refused, if the module logs an error outside of the partial ranges, or if
+ * the TA still holds regions once all the contexts are gone.
+ *
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#include <getopt.h>
+#include <unistd.h>
+
+#include <linux/smaf-secure.h>
+
+#include "kshim.h"
+
+#define MAX_THREADS	64
+#define BUFFER_SIZE	0x10000
+#define DUMP_SIZE	(256 * 1024)
+
+enum {
+	DEV_DELTA,
+	DEV_BDISP,
+	DEV_STI,
+	NR_DEVICES,
+};
+
+static struct device_driver drivers[NR_DEVICES] = {
+	[DEV_DELTA] = { "delta" },
+	[DEV_BDISP] = { "bdisp" },
+	[DEV_STI] = { "sti" },
+};
+
+static struct device devices[NR_DEVICES];
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	unsigned int seed;
+	unsigned long ops;
+	unsigned long grant_failures;
+	unsigned long partial_failures;
+};
+
+static struct worker workers[MAX_THREADS];
+static unsigned int nr_threads = 4;
+static unsigned int iterations = 200;
+static unsigned int nr_buffers = 8;
+static bool partial;
+
+extern unsigned long teec_invokes;
+extern int kshim_loglevel;
+
+/* each thread has its own window of addresses */
+static size_t buffer_addr(const struct worker *w, unsigned int buffer)
+{
+	return 0x40000000UL + (size_t)w->id * 0x1000000UL +
+	       (size_t)buffer * BUFFER_SIZE;
+}
+
+static bool do_grant(struct worker *w, void *ctx, int dev, size_t addr,
+		     size_t size, enum dma_data_direction dir)
+{
+	w->ops++;
+	return kshim_smaf_secure->grant_access(ctx, &devices[dev], addr, size,
+					       dir);
+}
+
+static void do_revoke(struct worker *w, void *ctx, int dev, size_t addr,
+		      size_t size, enum dma_data_direction dir)
+{
+	w->ops++;
+	kshim_smaf_secure->revoke_access(ctx, &devices[dev], addr, size, dir);
+}
+
+/* decoder writes the buffer, the display and the blitter read it */
+static void decode_display(struct worker *w, void *ctx, size_t addr,
+			   size_t size)
+{
+	bool blit = rand_r(&w->seed) & 1;
+
+	if (!do_grant(w, ctx, DEV_DELTA, addr, size, DMA_FROM_DEVICE))
+		w->grant_failures++;
+	if (!do_grant(w, ctx, DEV_STI, addr, size, DMA_TO_DEVICE))
+		w->grant_failures++;
+	if (blit &&
+	    !do_grant(w, ctx, DEV_BDISP, addr, size, DMA_TO_DEVICE))
+		w->grant_failures++;
+
+	if (rand_r(&w->seed) & 1) {
+		do_revoke(w, ctx, DEV_STI, addr, size, DMA_TO_DEVICE);
+		do_revoke(w, ctx, DEV_DELTA, addr, size, DMA_FROM_DEVICE);
+	} else {
+		do_revoke(w, ctx, DEV_DELTA, addr, size, DMA_FROM_DEVICE);
+		do_revoke(w, ctx, DEV_STI, addr, size, DMA_TO_DEVICE);
+	}
+	if (blit)
+		do_revoke(w, ctx, DEV_BDISP, addr, size, DMA_TO_DEVICE);
+}
+
+/* ranges across or inside buffers, the module may refuse some of them */
+static void partial_ranges(struct worker *w, void *ctx)
+{
+	unsigned int buffer = rand_r(&w->seed) % nr_buffers;
+	unsigned int count = 1 + rand_r(&w->seed) % 3;
+	size_t addr = buffer_addr(w, buffer);
+	size_t size = (size_t)count * BUFFER_SIZE;
+
+	if (buffer + count > nr_buffers)
+		size = (size_t)(nr_buffers - buffer) * BUFFER_SIZE;
+
+	if (rand_r(&w->seed) & 1) {
+		addr += BUFFER_SIZE / 2;
+		size -= BUFFER_SIZE / 2;
+	}
+
+	kshim_expect_errors(true);
+	if (!do_grant(w, ctx, DEV_STI, addr, size, DMA_TO_DEVICE))
+		w->partial_failures++;
+	do_revoke(w, ctx, DEV_STI, addr, size, DMA_TO_DEVICE);
+	kshim_expect_errors(false);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int i, b;
+	void *ctx;
+
+	for (i = 0; i < iterations; i++) {
+		ctx = kshim_smaf_secure->create_ctx();
+		if (!ctx) {
+			w->grant_failures++;
+			continue;
+		}
+		w->ops++;
+
+		for (b = 0; b < nr_buffers; b++)
+			decode_display(w, ctx, buffer_addr(w, b), BUFFER_SIZE);
+
+		if (partial)
+			for (b = 0; b < nr_buffers; b++)
+				partial_ranges(w, ctx);
+
+		kshim_smaf_secure->destroy_ctx(ctx);
+		w->ops++;
+	}
+
+	return NULL;
+}
+
+/* regions the TA still holds, from the dump of its status */
+static int ta_regions(char *dump)
+{
+	const char *p = dump;
+	int count = 0;
+
+	if (kshim_debugfs_read("dump", dump, DUMP_SIZE) < 0)
+		return -1;
+
+	while ((p = strstr(p, "\nregion "))) {
+		count++;
+		p++;
+	}
+
+	return count;
+}
+
+static void show(const char *name, char *buf)
+{
+	if (kshim_debugfs_read(name, buf, DUMP_SIZE) < 0)
+		return;
+
+	printf("--- %s\n%s", name, buf);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-i iterations] [-b buffers] [-P] [-v]\n"
+		"          [-p param=value]...\n"
+		"  -t: threads, default 4\n"
+		"  -i: contexts created by each thread, default 200\n"
+		"  -b: buffers of each context, default 8\n"
+		"  -P: also grant ranges across and inside the buffers\n"
+		"  -p: set a module parameter, e.g. -p ring_size=64\n"
+		"  -v: show the module statistics and log\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long ops = 0, failures = 0, partial_failures = 0;
+	bool verbose = false;
+	char *dump, *value;
+	ktime_t start, elapsed;
+	unsigned int i;
+	int opt, left, ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:i:b:p:Pvh")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'b':
+			nr_buffers = atoi(optarg);
+			break;
+		case 'P':
+			partial = true;
+			break;
+		case 'p':
+			value = strchr(optarg, '=');
+			if (!value) {
+				usage(argv[0]);
+				return 2;
+			}
+			*value++ = '\0';
+			if (kshim_param_set(optarg, atoi(value))) {
+				fprintf(stderr, "no parameter %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (!nr_threads || nr_threads > MAX_THREADS || !nr_buffers ||
+	    nr_buffers > 0x1000000 / BUFFER_SIZE) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if (!verbose)
+		kshim_loglevel = 3;
+
+	dump = malloc(DUMP_SIZE);
+	if (!dump)
+		return 2;
+
+	for (i = 0; i < NR_DEVICES; i++)
+		devices[i].driver = &drivers[i];
+
+	if (kshim_module_init() || !kshim_smaf_secure) {
+		fprintf(stderr, "failed to load the module\n");
+		return 2;
+	}
+
+	start = ktime_get();
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		workers[i].seed = i + 1;
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i])) {
+			fprintf(stderr, "failed to start thread %u\n", i);
+			return 2;
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+		failures += workers[i].grant_failures;
+		partial_failures += workers[i].partial_failures;
+	}
+
+	elapsed = ktime_get() - start;
+
+	printf("%u threads: %lu ops in %lld ms, %.0f ops/s, %.0f ns/op, %lu TA commands\n",
+	       nr_threads, ops, elapsed / NSEC_PER_MSEC,
+	       ops * 1e9 / elapsed, (double)elapsed / ops, teec_invokes);
+	if (partial)
+		printf("partial ranges refused: %lu, %lu errors logged\n",
+		       partial_failures, kshim_expected_errors);
+
+	if (verbose) {
+		show("stats", dump);
+		show("sessions", dump);
+		show("shadow", dump);
+		show("ring", dump);
+		show("regions", dump);
+	}
+
+	if (failures) {
+		printf("FAIL: %lu grants refused\n", failures);
+		ret = 1;
+	}
+
+	if (kshim_errors) {
+		printf("FAIL: %lu unexpected errors logged\n", kshim_errors);
+		ret = 1;
+	}
+
+	left = ta_regions(dump);
+	if (left) {
+		printf("FAIL: the TA holds %d regions after the contexts are destroyed\n",
+		       left);
+		if (verbose)
+			printf("%s", dump);
+		ret = 1;
+	}
+
+	kshim_module_exit();
+	rcu_barrier();
+	free(dump);
+
+	return ret;
+}
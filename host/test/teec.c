@@ -0,0 +1,239 @@
+/*
+ * teec.c
+ *
+ * TEE client backend of the harness: the commands go straight to the entry
+ * points of the TA built in the same process. The TA runs one command at a
+ * time, as a single instance TA does under OP-TEE.
+ *
+ * License terms:  GNU General Public License (GPL), version 2
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/tee_client_api.h>
+#include <tee_internal_api.h>
+
+static pthread_mutex_t ta_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ta_contexts;
+
+/* statistics of the harness */
+unsigned long teec_invokes;
+
+TEEC_Result TEEC_InitializeContext(const char *name, TEEC_Context *context)
+{
+	TEEC_Result res = TEEC_SUCCESS;
+
+	(void)name;
+
+	pthread_mutex_lock(&ta_lock);
+	if (!ta_contexts && TA_CreateEntryPoint() != TEE_SUCCESS)
+		res = TEEC_ERROR_GENERIC;
+	else
+		ta_contexts++;
+	pthread_mutex_unlock(&ta_lock);
+
+	context->fd = 0;
+
+	return res;
+}
+
+void TEEC_FinalizeContext(TEEC_Context *context)
+{
+	(void)context;
+
+	pthread_mutex_lock(&ta_lock);
+	if (ta_contexts && !--ta_contexts)
+		TA_DestroyEntryPoint();
+	pthread_mutex_unlock(&ta_lock);
+}
+
+/* translate the parameters of an operation for the TA */
+static int to_ta_params(const TEEC_Operation *op, uint32_t *types,
+			TEE_Param params[4])
+{
+	const TEEC_SharedMemory *shm;
+	uint32_t type, ta_type;
+	int i;
+
+	*types = 0;
+	memset(params, 0, 4 * sizeof(*params));
+
+	if (!op)
+		return 0;
+
+	for (i = 0; i < 4; i++) {
+		type = (op->paramTypes >> (i * 4)) & 0xF;
+
+		switch (type) {
+		case TEEC_NONE:
+			ta_type = TEE_PARAM_TYPE_NONE;
+			break;
+		case TEEC_VALUE_INPUT:
+		case TEEC_VALUE_OUTPUT:
+		case TEEC_VALUE_INOUT:
+			ta_type = type;
+			params[i].value.a = op->params[i].value.a;
+			params[i].value.b = op->params[i].value.b;
+			break;
+		case TEEC_MEMREF_TEMP_INPUT:
+		case TEEC_MEMREF_TEMP_OUTPUT:
+		case TEEC_MEMREF_TEMP_INOUT:
+			ta_type = type;
+			params[i].memref.buffer = op->params[i].tmpref.buffer;
+			params[i].memref.size = op->params[i].tmpref.size;
+			break;
+		case TEEC_MEMREF_WHOLE:
+			shm = op->params[i].memref.parent;
+			ta_type = TEE_PARAM_TYPE_MEMREF_INPUT - 1 +
+				  (shm->flags & (TEEC_MEM_INPUT | TEEC_MEM_OUTPUT));
+			params[i].memref.buffer = shm->buffer;
+			params[i].memref.size = shm->size;
+			break;
+		case TEEC_MEMREF_PARTIAL_INPUT:
+		case TEEC_MEMREF_PARTIAL_OUTPUT:
+		case TEEC_MEMREF_PARTIAL_INOUT:
+			shm = op->params[i].memref.parent;
+			ta_type = type - TEEC_MEMREF_PARTIAL_INPUT +
+				  TEE_PARAM_TYPE_MEMREF_INPUT;
+			params[i].memref.buffer = (char *)shm->buffer +
+						  op->params[i].memref.offset;
+			params[i].memref.size = op->params[i].memref.size;
+			break;
+		default:
+			return -1;
+		}
+
+		*types |= ta_type << (i * 4);
+	}
+
+	return 0;
+}
+
+/* give the outputs of the TA back to the operation */
+static void from_ta_params(TEEC_Operation *op, const TEE_Param params[4])
+{
+	uint32_t type;
+	int i;
+
+	if (!op)
+		return;
+
+	for (i = 0; i < 4; i++) {
+		type = (op->paramTypes >> (i * 4)) & 0xF;
+
+		switch (type) {
+		case TEEC_VALUE_OUTPUT:
+		case TEEC_VALUE_INOUT:
+			op->params[i].value.a = params[i].value.a;
+			op->params[i].value.b = params[i].value.b;
+			break;
+		case TEEC_MEMREF_TEMP_OUTPUT:
+		case TEEC_MEMREF_TEMP_INOUT:
+			op->params[i].tmpref.size = params[i].memref.size;
+			break;
+		case TEEC_MEMREF_WHOLE:
+		case TEEC_MEMREF_PARTIAL_OUTPUT:
+		case TEEC_MEMREF_PARTIAL_INOUT:
+			op->params[i].memref.size = params[i].memref.size;
+			break;
+		}
+	}
+}
+
+TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session,
+			     const TEEC_UUID *destination,
+			     uint32_t connection_method,
+			     const void *connection_data,
+			     TEEC_Operation *operation,
+			     uint32_t *return_origin)
+{
+	TEE_Param params[4];
+	uint32_t types;
+	TEE_Result res;
+
+	(void)destination;
+	(void)connection_method;
+	(void)connection_data;
+
+	if (return_origin)
+		*return_origin = TEEC_ORIGIN_API;
+	if (to_ta_params(operation, &types, params))
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&ta_lock);
+	res = TA_OpenSessionEntryPoint(types, params, &session->ta_session);
+	pthread_mutex_unlock(&ta_lock);
+
+	from_ta_params(operation, params);
+	session->ctx = context;
+	if (return_origin)
+		*return_origin = TEEC_ORIGIN_TRUSTED_APP;
+
+	return res;
+}
+
+void TEEC_CloseSession(TEEC_Session *session)
+{
+	pthread_mutex_lock(&ta_lock);
+	TA_CloseSessionEntryPoint(session->ta_session);
+	pthread_mutex_unlock(&ta_lock);
+}
+
+TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t cmd_id,
+			       TEEC_Operation *operation,
+			       uint32_t *return_origin)
+{
+	TEE_Param params[4];
+	uint32_t types;
+	TEE_Result res;
+
+	if (return_origin)
+		*return_origin = TEEC_ORIGIN_API;
+	if (to_ta_params(operation, &types, params))
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&ta_lock);
+	res = TA_InvokeCommandEntryPoint(session->ta_session, cmd_id, types,
+					 params);
+	teec_invokes++;
+	pthread_mutex_unlock(&ta_lock);
+
+	from_ta_params(operation, params);
+	if (return_origin)
+		*return_origin = TEEC_ORIGIN_TRUSTED_APP;
+
+	return res;
+}
+
+/* the TA sees the memory of the process, there is nothing to register */
+TEEC_Result TEEC_RegisterSharedMemory(TEEC_Context *context,
+				      TEEC_SharedMemory *shared_mem)
+{
+	(void)context;
+
+	shared_mem->allocated = 0;
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result TEEC_AllocateSharedMemory(TEEC_Context *context,
+				      TEEC_SharedMemory *shared_mem)
+{
+	(void)context;
+
+	shared_mem->buffer = calloc(1, shared_mem->size ? shared_mem->size : 1);
+	if (!shared_mem->buffer)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	shared_mem->allocated = 1;
+	return TEEC_SUCCESS;
+}
+
+void TEEC_ReleaseSharedMemory(TEEC_SharedMemory *shared_mem)
+{
+	if (shared_mem->allocated)
+		free(shared_mem->buffer);
+
+	shared_mem->buffer = NULL;
+	shared_mem->allocated = 0;
+}
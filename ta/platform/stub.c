@@ -5,12 +5,13 @@
  * Author: Benjamin Gaignard <benjamin.gaignard@linaro.org> for Linaro.
  * License terms: Lesser GNU General Public License (LGPL), version 2.1
  */
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "../sdp_platform_api.h"
-#include "string_ext.h"
+#include "stub_policy.h"
 
 #define ARRAY_SIZE(x) (int)(sizeof(x) / sizeof(*(x)))
 
@@ -73,68 +74,754 @@ struct secure_device stm_devices[] = {
 	{ "cpu"   , CPU,		 &cpu_inc_refcount,   &cpu_dec_refcount   },
 };
 
+/* set of devices, one bit per device handle */
+typedef uint32_t device_set_t;
+
+#define DEVICE_BIT(device)	((device_set_t)1 << platform_get_device_handle(device))
+
+/* fails to build if a device handle doesn't fit in a device set */
+typedef char device_set_check[ARRAY_SIZE(stm_devices) <=
+			      (int)(8 * sizeof(device_set_t)) ? 1 : -1];
+
 struct region {
-	uint64_t addr;
-	uint32_t size;
+	/* memory of the region, points to contiguous unless it is scattered */
+	struct platform_sg_entry *sg;
+	uint32_t nb_sg;
+	struct platform_sg_entry contiguous;
+	uint32_t owner;
+	/* id of the last device attached for writing, for the policy */
 	uint32_t writer;
-	uint32_t attached[4];
-	uint32_t direction[4];
+	/* attached devices, by access direction */
+	device_set_t readers;
+	device_set_t writers;
+	uint16_t generation;
+	int16_t next_free;
+};
+
+/*
+ * Regions are allocated by chunks, up to CFG_SDP_MAX_REGIONS, and free
+ * slots are linked together so create and destroy don't need to scan the
+ * table. A region identifier is made of the slot index and of the slot
+ * generation which is bumped on each destroy, so stale identifiers are
+ * rejected.
+ */
+#ifndef CFG_SDP_MAX_REGIONS
+#define CFG_SDP_MAX_REGIONS 128
+#endif
+
+#if CFG_SDP_MAX_REGIONS > 0x7FFF
+#error "CFG_SDP_MAX_REGIONS is too big"
+#endif
+
+#define REGIONS_PER_CHUNK	16
+#define MAX_CHUNKS	((CFG_SDP_MAX_REGIONS + REGIONS_PER_CHUNK - 1) / \
+			 REGIONS_PER_CHUNK)
+
+#define REGION_ID_SHIFT		16
+#define REGION_SLOT_MASK	((1 << REGION_ID_SHIFT) - 1)
+#define REGION_GEN_MASK		0x7FFF
+
+#define SLOT_NONE	(-1)
+#define SLOT_USED	(-2)
+
+static struct region *chunks[MAX_CHUNKS];
+static int nb_chunks;
+static int free_slot = SLOT_NONE;
+
+/*
+ * Index of the memory of the regions, one entry per contiguous range. The
+ * ranges of the regions can't overlap, so the entries sorted by address are
+ * sorted by end too and a binary search finds the range covering an address.
+ */
+struct index_entry {
+	uint64_t start;
+	uint64_t last;
+	int slot;
+};
+
+static struct index_entry *index_entries;
+static int index_size;
+static int index_max;
+
+/*
+ * Simulated firewall, with a set of registers per region slot. Changes to the
+ * regions are staged in a transaction and the registers of the changed slots
+ * are only programmed on commit, followed by a single synchronization.
+ */
+struct firewall_slot {
+	/* registers, as last programmed */
+	uint32_t enable;
+	uint32_t readers;
+	uint32_t writers;
+	/* ranges programmed, they change with the generation or a resize */
+	uint16_t generation;
+	uint64_t start;
+	uint64_t size;
+	/* last entry of the slot in the undo log, -1 if none */
+	int16_t undo;
+};
+
+static struct firewall_slot *firewall[MAX_CHUNKS];
+static uint32_t firewall_commits;
+static uint32_t firewall_writes;
+
+/*
+ * The state of a slot before its first change in a transaction is saved in
+ * the undo log, for abort. When more slots are staged than the log holds,
+ * the changes so far are committed and can't be aborted anymore.
+ */
+#ifndef CFG_SDP_MAX_STAGED
+#define CFG_SDP_MAX_STAGED	32
+#endif
+
+#if CFG_SDP_MAX_STAGED > 0x7FFF
+#error "CFG_SDP_MAX_STAGED is too big"
+#endif
+
+struct undo_entry {
+	int slot;
+	struct region saved;
 };
 
-#define MAX_REGIONS 20
-static struct region regions[MAX_REGIONS];
+static struct undo_entry undo_log[CFG_SDP_MAX_STAGED];
+static int undo_len;
 
-static int find_free_region(void)
+/* state at the start of each nested transaction, the deepest ones share */
+#define MAX_TRANSACTION_DEPTH	8
+
+struct savepoint {
+	int undo_len;
+	int nb_chunks;
+	int free_slot;
+	int refcounts[4];
+};
+
+static struct savepoint savepoints[MAX_TRANSACTION_DEPTH];
+static int transaction_depth;
+
+static struct region *slot_to_region(int slot)
+{
+	return &chunks[slot / REGIONS_PER_CHUNK][slot % REGIONS_PER_CHUNK];
+}
+
+static struct firewall_slot *slot_to_firewall(int slot)
+{
+	return &firewall[slot / REGIONS_PER_CHUNK][slot % REGIONS_PER_CHUNK];
+}
+
+static int region_to_slot(struct region *region)
 {
 	int i;
 
-	for (i = 0; i < MAX_REGIONS; i++)
-		if (regions[i].addr == 0)
-			return i;
+	for (i = 0; i < nb_chunks; i++)
+		if (region >= chunks[i] && region < chunks[i] + REGIONS_PER_CHUNK)
+			return i * REGIONS_PER_CHUNK + (region - chunks[i]);
 
 	return -1;
 }
 
+/* position of the last entry starting at or before addr, -1 if none */
+static int index_search(uint64_t addr)
+{
+	int low = 0, high = index_size, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (index_entries[mid].start <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low - 1;
+}
+
+/* return 0 if the range is indexed, it must not overlap an indexed range */
+static int index_insert(const struct platform_sg_entry *sg, int slot)
+{
+	struct index_entry *entries;
+	uint64_t last = sg->addr + sg->size - 1;
+	int pos, max;
+
+	if (sg->size == 0 || last < sg->addr)
+		return -1;
+
+	/* the entries after pos start after the range */
+	pos = index_search(last);
+	if (pos >= 0 && index_entries[pos].last >= sg->addr)
+		return -1;
+
+	if (index_size == index_max) {
+		max = index_max ? 2 * index_max : REGIONS_PER_CHUNK;
+		entries = TEE_Realloc(index_entries, max * sizeof(*entries));
+		if (!entries)
+			return -1;
+
+		index_entries = entries;
+		index_max = max;
+	}
+
+	pos++;
+	memmove(&index_entries[pos + 1], &index_entries[pos],
+		(index_size - pos) * sizeof(*index_entries));
+	index_entries[pos].start = sg->addr;
+	index_entries[pos].last = last;
+	index_entries[pos].slot = slot;
+	index_size++;
+
+	return 0;
+}
+
+static void index_remove(const struct platform_sg_entry *sg, int slot)
+{
+	int pos = index_search(sg->addr);
+
+	if (pos < 0 || index_entries[pos].start != sg->addr ||
+	    index_entries[pos].slot != slot)
+		return;
+
+	index_size--;
+	memmove(&index_entries[pos], &index_entries[pos + 1],
+		(index_size - pos) * sizeof(*index_entries));
+}
+
+/* index all the ranges of a region, none of them on failure */
+static int index_region(struct region *region, int slot)
+{
+	uint32_t i;
+
+	for (i = 0; i < region->nb_sg; i++) {
+		if (index_insert(&region->sg[i], slot)) {
+			while (i--)
+				index_remove(&region->sg[i], slot);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void unindex_region(struct region *region, int slot)
+{
+	uint32_t i;
+
+	for (i = 0; i < region->nb_sg; i++)
+		index_remove(&region->sg[i], slot);
+}
+
+/* program the registers of a slot which differ from its region */
+static void firewall_program(int slot)
+{
+	struct firewall_slot *fw = slot_to_firewall(slot);
+	struct region *region = slot_to_region(slot);
+	uint32_t enable = region->next_free == SLOT_USED;
+
+	/* the registers of a disabled slot are left as they are */
+	if (!enable) {
+		if (fw->enable) {
+			fw->enable = 0;
+			firewall_writes++;
+		}
+		return;
+	}
+
+	/* a start and an end register per range */
+	if (!fw->enable || fw->generation != region->generation ||
+	    fw->start != region->sg[0].addr || fw->size != region->sg[0].size) {
+		fw->generation = region->generation;
+		fw->start = region->sg[0].addr;
+		fw->size = region->sg[0].size;
+		firewall_writes += 2 * region->nb_sg;
+	}
+
+	if (fw->readers != region->readers) {
+		fw->readers = region->readers;
+		firewall_writes++;
+	}
+
+	if (fw->writers != region->writers) {
+		fw->writers = region->writers;
+		firewall_writes++;
+	}
+
+	if (!fw->enable) {
+		fw->enable = 1;
+		firewall_writes++;
+	}
+}
+
+static struct savepoint *current_savepoint(void)
+{
+	if (transaction_depth > MAX_TRANSACTION_DEPTH)
+		return &savepoints[MAX_TRANSACTION_DEPTH - 1];
+
+	return &savepoints[transaction_depth - 1];
+}
+
+static void save_state(struct savepoint *savepoint)
+{
+	savepoint->undo_len = undo_len;
+	savepoint->nb_chunks = nb_chunks;
+	savepoint->free_slot = free_slot;
+	savepoint->refcounts[0] = delta_refcount;
+	savepoint->refcounts[1] = bdisp_refcount;
+	savepoint->refcounts[2] = sti_refcount;
+	savepoint->refcounts[3] = cpu_refcount;
+}
+
+/* whether the undo log entries before end keep the parts sg */
+static bool undo_holds(const struct platform_sg_entry *sg, int end)
+{
+	int i;
+
+	for (i = 0; i < end; i++)
+		if (undo_log[i].saved.sg == sg)
+			return true;
+
+	return false;
+}
+
+/* whether entry is the first one of its slot from the entry start */
+static bool undo_first(int entry, int start)
+{
+	int i;
+
+	for (i = start; i < entry; i++)
+		if (undo_log[i].slot == undo_log[entry].slot)
+			return false;
+
+	return true;
+}
+
+/* program the staged slots and forget their saved state */
+static void firewall_flush(void)
+{
+	struct platform_sg_entry *sg;
+	struct region *region;
+	uint32_t writes = firewall_writes;
+	int i;
+
+	for (i = 0; i < undo_len; i++) {
+		region = slot_to_region(undo_log[i].slot);
+		sg = undo_log[i].saved.sg;
+
+		if (undo_first(i, 0))
+			firewall_program(undo_log[i].slot);
+
+		/* the parts of a destroyed or replaced region were kept */
+		if (sg && sg != &region->contiguous && sg != region->sg &&
+		    !undo_holds(sg, i))
+			TEE_Free(sg);
+	}
+
+	undo_len = 0;
+
+	/* flush the firewall once for all the registers written */
+	if (firewall_writes != writes) {
+		firewall_writes++;
+		firewall_commits++;
+	}
+
+	/* nothing before this point can be aborted */
+	for (i = 0; i < transaction_depth && i < MAX_TRANSACTION_DEPTH; i++)
+		save_state(&savepoints[i]);
+}
+
+/* save the region of a slot before its first change in the transaction */
+static void stage_slot(int slot)
+{
+	struct firewall_slot *fw = slot_to_firewall(slot);
+
+	if (fw->undo >= current_savepoint()->undo_len && fw->undo < undo_len &&
+	    undo_log[fw->undo].slot == slot)
+		return;
+
+	if (undo_len == CFG_SDP_MAX_STAGED)
+		firewall_flush();
+
+	undo_log[undo_len].slot = slot;
+	undo_log[undo_len].saved = *slot_to_region(slot);
+	fw->undo = undo_len++;
+}
+
+static int grow_regions(void)
+{
+	struct firewall_slot *fw;
+	struct region *chunk;
+	int i, first;
+
+	if (nb_chunks >= MAX_CHUNKS)
+		return -1;
+
+	chunk = TEE_Malloc(REGIONS_PER_CHUNK * sizeof(*chunk), 0);
+	if (!chunk)
+		return -1;
+
+	fw = TEE_Malloc(REGIONS_PER_CHUNK * sizeof(*fw), 0);
+	if (!fw) {
+		TEE_Free(chunk);
+		return -1;
+	}
+
+	memset(chunk, 0, REGIONS_PER_CHUNK * sizeof(*chunk));
+	memset(fw, 0, REGIONS_PER_CHUNK * sizeof(*fw));
+
+	first = nb_chunks * REGIONS_PER_CHUNK;
+	firewall[nb_chunks] = fw;
+	chunks[nb_chunks++] = chunk;
+
+	/* push the new slots so that the lowest one is used first */
+	for (i = REGIONS_PER_CHUNK - 1; i >= 0; i--) {
+		fw[i].undo = -1;
+		chunk[i].next_free = free_slot;
+		free_slot = first + i;
+	}
+
+	return 0;
+}
+
+static int alloc_region_slot(void)
+{
+	int slot;
+
+	if (free_slot == SLOT_NONE && grow_regions())
+		return -1;
+
+	slot = free_slot;
+	stage_slot(slot);
+	free_slot = slot_to_region(slot)->next_free;
+	slot_to_region(slot)->next_free = SLOT_USED;
+
+	return slot;
+}
+
+/* give the slot back, the identifiers of the region become stale */
+static void free_region_slot(struct region *region, int slot)
+{
+	uint16_t generation = (region->generation + 1) & REGION_GEN_MASK;
+
+	stage_slot(slot);
+
+	/* the parts of the region before the transaction are kept for abort */
+	if (region->sg != &region->contiguous &&
+	    !undo_holds(region->sg, undo_len))
+		TEE_Free(region->sg);
+
+	memset(region, 0, sizeof(*region));
+	region->generation = generation;
+	region->next_free = free_slot;
+	free_slot = slot;
+}
+
+static int region_to_id(struct region *region, int slot)
+{
+	return (region->generation << REGION_ID_SHIFT) | slot;
+}
+
+static struct region *id_to_region(int id, int *slot)
+{
+	struct region *region;
+
+	if (id < 0)
+		return NULL;
+
+	*slot = id & REGION_SLOT_MASK;
+	if (*slot >= nb_chunks * REGIONS_PER_CHUNK)
+		return NULL;
+
+	region = slot_to_region(*slot);
+	if (region->next_free != SLOT_USED ||
+	    region->generation != (id >> REGION_ID_SHIFT))
+		return NULL;
+
+	return region;
+}
+
 int platform_init(void)
 {
+	int i;
+
 	delta_refcount = 0;
 	bdisp_refcount = 0;
 	sti_refcount   = 0;
 
-	memset(&regions, 0, sizeof(regions));
+	for (i = 0; i < nb_chunks * REGIONS_PER_CHUNK; i++) {
+		struct region *region = slot_to_region(i);
+
+		if (region->next_free == SLOT_USED &&
+		    region->sg != &region->contiguous)
+			TEE_Free(region->sg);
+	}
+
+	for (i = 0; i < nb_chunks; i++) {
+		TEE_Free(chunks[i]);
+		chunks[i] = NULL;
+		TEE_Free(firewall[i]);
+		firewall[i] = NULL;
+	}
+
+	nb_chunks = 0;
+	free_slot = SLOT_NONE;
+
+	transaction_depth = 0;
+	undo_len = 0;
+	firewall_commits = 0;
+	firewall_writes = 0;
+
+	TEE_Free(index_entries);
+	index_entries = NULL;
+	index_size = 0;
+	index_max = 0;
 
 	return 0;
 }
 
-int platform_create_region(uint64_t addr, uint32_t size)
+void platform_begin(void)
 {
-	int index = find_free_region();
+	if (transaction_depth++ < MAX_TRANSACTION_DEPTH)
+		save_state(current_savepoint());
+}
 
-	if (index < 0)
-		return index;
+int platform_commit(void)
+{
+	if (!transaction_depth)
+		return -1;
 
-	regions[index].addr = addr;
-	regions[index].size = size;
+	if (--transaction_depth)
+		return 0;
 
-	return index;
+	firewall_flush();
+	return 0;
+}
+
+void platform_abort(void)
+{
+	struct savepoint *savepoint;
+	struct platform_sg_entry *sg;
+	struct region *region;
+	int slot, i;
+
+	if (!transaction_depth)
+		return;
+
+	savepoint = current_savepoint();
+
+	/* unindex everything first, the old ranges may overlap the new ones */
+	for (i = savepoint->undo_len; i < undo_len; i++) {
+		region = slot_to_region(undo_log[i].slot);
+		if (undo_first(i, savepoint->undo_len) &&
+		    region->next_free == SLOT_USED)
+			unindex_region(region, undo_log[i].slot);
+	}
+
+	/* restore from the newest entry, the oldest one of a slot wins */
+	for (i = undo_len - 1; i >= savepoint->undo_len; i--) {
+		region = slot_to_region(undo_log[i].slot);
+		sg = region->sg;
+
+		if (region->next_free == SLOT_USED &&
+		    sg != &region->contiguous && !undo_holds(sg, i + 1))
+			TEE_Free(sg);
+
+		*region = undo_log[i].saved;
+	}
+
+	for (i = savepoint->undo_len; i < undo_len; i++) {
+		slot = undo_log[i].slot;
+		region = slot_to_region(slot);
+		if (undo_first(i, savepoint->undo_len) &&
+		    region->next_free == SLOT_USED)
+			index_region(region, slot);
+	}
+
+	undo_len = savepoint->undo_len;
+
+	/* the chunks added by the transaction only hold free slots now */
+	for (i = savepoint->nb_chunks; i < nb_chunks; i++) {
+		TEE_Free(chunks[i]);
+		chunks[i] = NULL;
+		TEE_Free(firewall[i]);
+		firewall[i] = NULL;
+	}
+
+	nb_chunks = savepoint->nb_chunks;
+	free_slot = savepoint->free_slot;
+	delta_refcount = savepoint->refcounts[0];
+	bdisp_refcount = savepoint->refcounts[1];
+	sti_refcount = savepoint->refcounts[2];
+	cpu_refcount = savepoint->refcounts[3];
+
+	transaction_depth--;
 }
 
-int platform_destroy_region(int index)
+int platform_create_region(uint64_t addr, uint64_t size)
 {
-	if(index > MAX_REGIONS)
+	struct region *region;
+	int slot, ret = -1;
+
+	platform_begin();
+
+	slot = alloc_region_slot();
+	if (slot < 0)
+		goto out;
+
+	region = slot_to_region(slot);
+	region->contiguous.addr = addr;
+	region->contiguous.size = size;
+	region->sg = &region->contiguous;
+	region->nb_sg = 1;
+
+	if (index_region(region, slot)) {
+		free_region_slot(region, slot);
+		goto out;
+	}
+
+	ret = region_to_id(region, slot);
+
+out:
+	platform_commit();
+	return ret;
+}
+
+int platform_create_region_sg(const struct platform_sg_entry *sg,
+			      uint32_t nb_sg)
+{
+	struct platform_sg_entry *copy;
+	struct region *region;
+	int slot, ret = -1;
+
+	if (nb_sg == 1)
+		return platform_create_region(sg[0].addr, sg[0].size);
+
+	copy = TEE_Malloc(nb_sg * sizeof(*copy), 0);
+	if (!copy)
 		return -1;
 
-	memset(&regions[index], 0, sizeof(regions[index]));
+	platform_begin();
+
+	slot = alloc_region_slot();
+	if (slot < 0) {
+		TEE_Free(copy);
+		goto out;
+	}
+
+	memcpy(copy, sg, nb_sg * sizeof(*copy));
+
+	region = slot_to_region(slot);
+	region->sg = copy;
+	region->nb_sg = nb_sg;
+
+	if (index_region(region, slot)) {
+		free_region_slot(region, slot);
+		goto out;
+	}
+
+	ret = region_to_id(region, slot);
+
+out:
+	platform_commit();
+	return ret;
+}
+
+int platform_resize_region(struct region *region, uint64_t addr,
+			   uint64_t size)
+{
+	struct platform_sg_entry old = region->contiguous;
+	int slot = region_to_slot(region);
+	int ret = 0;
+
+	if (region->nb_sg != 1)
+		return -1;
+
+	platform_begin();
+	stage_slot(slot);
+
+	index_remove(&old, slot);
+
+	region->contiguous.addr = addr;
+	region->contiguous.size = size;
+
+	if (index_insert(&region->contiguous, slot)) {
+		/* the old range fits back in the room it left */
+		region->contiguous = old;
+		index_insert(&region->contiguous, slot);
+		ret = -1;
+	}
+
+	platform_commit();
+	return ret;
+}
+
+/* the owner isn't programmed in the firewall */
+void platform_set_region_owner(struct region *region, uint32_t owner)
+{
+	platform_begin();
+	stage_slot(region_to_slot(region));
+	region->owner = owner;
+	platform_commit();
+}
+
+int platform_destroy_owner_regions(uint32_t owner)
+{
+	struct region *region;
+	int i, count = 0;
+
+	platform_begin();
+
+	for (i = 0; i < nb_chunks * REGIONS_PER_CHUNK; i++) {
+		region = slot_to_region(i);
+		if (region->next_free == SLOT_USED && region->owner == owner) {
+			platform_destroy_region(region_to_id(region, i));
+			count++;
+		}
+	}
+
+	platform_commit();
+	return count;
+}
+
+int platform_destroy_region(int id)
+{
+	struct region *region;
+	int slot;
+
+	region = id_to_region(id, &slot);
+	if (!region)
+		return -1;
+
+	platform_begin();
+	unindex_region(region, slot);
+	free_region_slot(region, slot);
+	platform_commit();
 
 	return 0;
 }
 
-struct region* platform_find_region_by_id(int index)
+struct region* platform_find_region_by_id(int id)
 {
-	if(index > MAX_REGIONS)
-		return NULL;
+	int slot;
+
+	return id_to_region(id, &slot);
+}
+
+int platform_find_region_by_addr(uint64_t addr)
+{
+	int pos = index_search(addr);
+	int slot;
+
+	if (pos < 0 || index_entries[pos].last < addr)
+		return -1;
+
+	slot = index_entries[pos].slot;
 
-	return &regions[index];
+	return region_to_id(slot_to_region(slot), slot);
+}
+
+void platform_get_region_access(struct region *region, uint32_t *readers,
+				uint32_t *writers)
+{
+	*readers = region->readers;
+	*writers = region->writers;
 }
 
 struct secure_device* platform_find_device_by_name(char *name)
@@ -149,29 +836,34 @@ struct secure_device* platform_find_device_by_name(char *name)
 	return NULL;
 }
 
+/* the handle is the index of the device in stm_devices */
+uint32_t platform_get_device_handle(struct secure_device *device)
+{
+	return device - stm_devices;
+}
+
+struct secure_device *platform_find_device_by_handle(uint32_t handle)
+{
+	if (handle >= (uint32_t)ARRAY_SIZE(stm_devices))
+		return NULL;
+
+	return &stm_devices[handle];
+}
+
 /* return 0 if we can add the device to the region */
 int platform_check_permissions(struct region *region, struct secure_device* device, int dir)
 {
-	if ((region->writer == 0) && (dir == DIR_WRITE))
-		return 0;
+	uint8_t access;
 
 	if ((region->writer == device->id) && (dir == DIR_WRITE))
 		return 0;
 
-	if (IS_CPU(region->writer) && (dir != DIR_WRITE) && !IS_CPU(device->id))
-		return 0;
-
-	if (IS_DECODER(region->writer) && (dir != DIR_WRITE) && IS_TRANSFORMER(device->id))
-		if (STREAM_TYPE(region->writer) == STREAM_TYPE(device->id))
-			return 0;
+	access = policy_table[policy_index(region->writer)][policy_index(device->id)];
 
-	if (IS_DECODER(region->writer) && (dir != DIR_WRITE) && IS_SINK(device->id))
-		if (STREAM_TYPE(region->writer) == STREAM_TYPE(device->id))
-			return 0;
-
-	if (IS_TRANSFORMER(region->writer) && (dir != DIR_WRITE) && IS_SINK(device->id))
-		if (STREAM_TYPE(region->writer) == STREAM_TYPE(device->id))
-			return 0;
+	if ((access & (dir == DIR_WRITE ? POLICY_WRITE : POLICY_READ)) &&
+	    (!(access & POLICY_SAME_STREAM) ||
+	     STREAM_TYPE(region->writer) == STREAM_TYPE(device->id)))
+		return 0;
 
 	IMSG("platform_check_permissions failed region->writer 0x%x dir %d device->id 0x%x\n", region->writer, dir, device->id);
 	return 1;
@@ -179,44 +871,47 @@ int platform_check_permissions(struct region *region, struct secure_device* devi
 
 int platform_add_device_to_region(struct region *region, struct secure_device* device, int dir)
 {
-	int i;
+	device_set_t bit = DEVICE_BIT(device);
+
+	platform_begin();
+	stage_slot(region_to_slot(region));
 
 	if (dir == DIR_WRITE) {
 		region->writer = device->id;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(stm_devices); i++) {
-		if (region->attached[i] == 0 || region->attached[i] == device->id) {
-			region->attached[i]  = device->id;
-			region->direction[i] = dir;
-			goto inc_dev;
-		}
-	}
+	/* a device attached again gets the new direction, and no new reference */
+	if (!((region->readers | region->writers) & bit))
+		device->inc_refcount();
 
-	return 1;
+	region->readers &= ~bit;
+	region->writers &= ~bit;
 
-inc_dev:
-	device->inc_refcount();
+	if (dir != DIR_WRITE)
+		region->readers |= bit;
+	if (dir != DIR_READ)
+		region->writers |= bit;
 
+	platform_commit();
 	return 0;
 }
 
 int platform_remove_device_from_region(struct region *region, struct secure_device* device)
 {
-	int i;
+	device_set_t bit = DEVICE_BIT(device);
 
-	for (i = 0; i < ARRAY_SIZE(stm_devices); i++) {
-		if (region->attached[i] == device->id) {
-			region->attached[i]  = 0;
-			region->direction[i] = 0;
-			goto dec_dev;
-		}
-	}
+	if (!((region->readers | region->writers) & bit))
+		return 1;
 
-	return 1;
+	platform_begin();
+	stage_slot(region_to_slot(region));
+
+	region->readers &= ~bit;
+	region->writers &= ~bit;
 
-dec_dev:
 	device->dec_refcount();
+
+	platform_commit();
 	return 0;
 }
 
@@ -247,19 +942,45 @@ int platform_dump_status(char *dump, int size)
 	tmp += writed;
 	size -= writed;
 
-	for (i = 0; i < MAX_REGIONS; i++) {
-		if (regions[i].addr) {
-			struct region *region = &regions[i];
-			writed = snprintf(tmp, size, "region addr 0x%x size %d writer 0x%x\n", (uint32_t)region->addr, region->size, region->writer);
+	writed = snprintf(tmp, size, "firewall commits %u register writes %u\n", firewall_commits, firewall_writes);
+	tmp += writed;
+	size -= writed;
+
+	for (i = 0; i < nb_chunks * REGIONS_PER_CHUNK; i++) {
+		/* stop once the buffer is full, there can be many regions */
+		if (size <= 0)
+			break;
+
+		if (slot_to_region(i)->next_free == SLOT_USED) {
+			struct region *region = slot_to_region(i);
+			writed = snprintf(tmp, size, "region writer 0x%x\n", region->writer);
 			tmp += writed;
 			size -= writed;
 
-			for (j = 0; j < ARRAY_SIZE(stm_devices); j++)
-				if (region->attached[j]) {
-					writed = snprintf(tmp, size, "attached 0x%x direction %d\n", region->attached[j], region->direction[j]);
-					tmp += writed;
-					size -= writed;
-				}
+			for (j = 0; j < (int)region->nb_sg && size > 0; j++) {
+				writed = snprintf(tmp, size, "addr 0x%" PRIx64 " size 0x%" PRIx64 "\n", region->sg[j].addr, region->sg[j].size);
+				tmp += writed;
+				size -= writed;
+			}
+
+			for (j = 0; j < ARRAY_SIZE(stm_devices) && size > 0; j++) {
+				device_set_t bit = DEVICE_BIT(&stm_devices[j]);
+				int dir;
+
+				if (!((region->readers | region->writers) & bit))
+					continue;
+
+				if (!(region->writers & bit))
+					dir = DIR_READ;
+				else if (!(region->readers & bit))
+					dir = DIR_WRITE;
+				else
+					dir = DIR_RW;
+
+				writed = snprintf(tmp, size, "attached 0x%x direction %d\n", stm_devices[j].id, dir);
+				tmp += writed;
+				size -= writed;
+			}
 		}
 
 	}
@@ -0,0 +1,79 @@
+/*
+ * stub_policy.h
+ *
+ * Declarative access policy of the STUB platform, compiled into a dense
+ * lookup table indexed by writer and reader classes.
+ *
+ * License terms: Lesser GNU General Public License (LGPL), version 2.1
+ */
+#ifndef _STUB_POLICY_H_
+#define _STUB_POLICY_H_
+
+#include "../sdp_platform_api.h"
+
+/* access given by a rule */
+#define POLICY_READ		(1 << 0)	/* any direction but DIR_WRITE */
+#define POLICY_WRITE		(1 << 1)	/* DIR_WRITE */
+#define POLICY_SAME_STREAM	(1 << 2)	/* writer and reader stream types match */
+
+/*
+ * Table index of a device id: its device type, NO_WRITER for an empty
+ * writer and OTHER for any type without a rule.
+ */
+#define POLICY_NO_WRITER	0
+#define POLICY_OTHER		7
+#define POLICY_NB_CLASSES	8
+
+#define POLICY_CLASS(x)		(((x) >> 24) & 0xFF)
+
+/* set of reader classes */
+#define READERS(x)		(1 << POLICY_CLASS(x))
+#define ANY_READER		((1 << POLICY_NB_CLASSES) - 1)
+#define ANY_READER_BUT(x)	(ANY_READER & ~READERS(x))
+
+/*
+ * The policy: POLICY_RULE(writer type, reader types, access)
+ *
+ * A writer can always be granted DIR_WRITE again, this doesn't depend on
+ * the classes and isn't part of the table.
+ */
+#define POLICY_RULES(RULE, w, r) \
+	/* a region without writer can be written by anyone */ \
+	RULE(w, r, POLICY_NO_WRITER, ANY_READER, POLICY_WRITE) \
+	/* CPU output can be read by any device */ \
+	RULE(w, r, CPU, ANY_READER_BUT(CPU), POLICY_READ) \
+	/* decoded frames go to a transformer or to a sink */ \
+	RULE(w, r, DECODER, READERS(TRANSFORMER) | READERS(SINK), \
+	     POLICY_READ | POLICY_SAME_STREAM) \
+	/* transformed frames go to a sink */ \
+	RULE(w, r, TRANSFORMER, READERS(SINK), \
+	     POLICY_READ | POLICY_SAME_STREAM)
+
+/* table generation */
+#define POLICY_APPLY(w, r, writer, readers, access) \
+	| ((POLICY_CLASS(writer) == (w) && ((readers) & (1 << (r)))) ? \
+	   (access) : 0)
+
+#define POLICY_CELL(w, r)	(0 POLICY_RULES(POLICY_APPLY, w, r))
+
+#define POLICY_ROW(w)	{ \
+	POLICY_CELL(w, 0), POLICY_CELL(w, 1), POLICY_CELL(w, 2), \
+	POLICY_CELL(w, 3), POLICY_CELL(w, 4), POLICY_CELL(w, 5), \
+	POLICY_CELL(w, 6), POLICY_CELL(w, 7) }
+
+static const uint8_t policy_table[POLICY_NB_CLASSES][POLICY_NB_CLASSES] = {
+	POLICY_ROW(0), POLICY_ROW(1), POLICY_ROW(2), POLICY_ROW(3),
+	POLICY_ROW(4), POLICY_ROW(5), POLICY_ROW(6), POLICY_ROW(7),
+};
+
+static inline int policy_index(uint32_t id)
+{
+	uint32_t class = POLICY_CLASS(id);
+
+	if (class == POLICY_NO_WRITER && id)
+		return POLICY_OTHER;
+
+	return class < POLICY_OTHER ? (int)class : POLICY_OTHER;
+}
+
+#endif
@@ -6,7 +6,6 @@
 #define _SDP_PLATFORM_API_H_
 
 #include <tee_internal_api.h>
-#include <tee_internal_api_extensions.h>
 
 /* those definitions need to be aligned
  * with enum dma_data_direction definitions */
@@ -46,6 +45,17 @@
  */
 struct secure_device;
 
+/**
+ * struct platform_sg_entry - a contiguous part of a region
+ *
+ * @addr: start address
+ * @size: length
+ */
+struct platform_sg_entry {
+	uint64_t addr;
+	uint64_t size;
+};
+
 /**
  * struct region - opaque structure to be customize
  * by each platform to macth with hardware requirement
@@ -60,16 +70,92 @@ struct region;
  */
 int platform_init(void);
 
+/**
+ * platform_begin - start staging changes to the regions
+ *
+ * the changes made until platform_commit() or platform_abort() are applied
+ * to the hardware at once, a function changing a region outside of a
+ * transaction applies its change before returning
+ *
+ * transactions nest, only the outermost one is committed and a nested one
+ * can be aborted alone
+ */
+void platform_begin(void);
+
+/**
+ * platform_commit - apply the changes staged since platform_begin()
+ *
+ * return 0 if success
+ */
+int platform_commit(void);
+
+/**
+ * platform_abort - drop the changes staged since platform_begin()
+ *
+ * the regions, their parts and their devices are restored as they were
+ * when the matching platform_begin() was called, the transaction is ended
+ */
+void platform_abort(void);
+
 /**
  * platform_create_region - request the creation of a region
  *
  * @addr: start address of the memory
  * @size: lenght of the memory
  *
+ * the memory must not overlap the memory of another region
+ *
  * if success return a (unique) region identifier
  * else return a negative value
  */
-int platform_create_region(uint64_t addr, uint32_t size);
+int platform_create_region(uint64_t addr, uint64_t size);
+
+/**
+ * platform_create_region_sg - request the creation of a region made of
+ * several parts, managed as a single region
+ *
+ * @sg: the parts of the memory, copied by the platform
+ * @nb_sg: number of parts
+ *
+ * the parts must not overlap each other or another region
+ *
+ * if success return a (unique) region identifier
+ * else return a negative value
+ */
+int platform_create_region_sg(const struct platform_sg_entry *sg,
+			      uint32_t nb_sg);
+
+/**
+ * platform_resize_region - move the bounds of a region
+ *
+ * @region: targeted region, made of a single part
+ * @addr: new start address of the memory
+ * @size: new lenght of the memory
+ *
+ * the permissions of the region apply to the new bounds, which must not
+ * overlap another region
+ *
+ * return 0 if success
+ */
+int platform_resize_region(struct region *region, uint64_t addr,
+			   uint64_t size);
+
+/**
+ * platform_set_region_owner - tag a region with its owner
+ *
+ * @region: targeted region
+ * @owner: owner given by the caller, 0 for none
+ */
+void platform_set_region_owner(struct region *region, uint32_t owner);
+
+/**
+ * platform_destroy_owner_regions - destroy all the regions of an owner
+ *
+ * @owner: the owner, not 0
+ *
+ * return the number of regions destroyed
+ */
+int platform_destroy_owner_regions(uint32_t owner);
 
 /**
  * platform_destroy_region - destroy a specific region
@@ -91,6 +177,26 @@ int platform_destroy_region(int id);
  */
 struct region *platform_find_region_by_id(int id);
 
+/**
+ * platform_find_region_by_addr - find the region covering an address
+ *
+ * @addr: the physical address
+ *
+ * return the region identifier if a region covers the address
+ * else return a negative value
+ */
+int platform_find_region_by_addr(uint64_t addr);
+
+/**
+ * platform_get_region_access - get the devices attached to a region
+ *
+ * @region: targeted region
+ * @readers: set of the devices which can read, bit n for device handle n
+ * @writers: set of the devices which can write, same layout
+ */
+void platform_get_region_access(struct region *region, uint32_t *readers,
+				uint32_t *writers);
+
 /**
  * platform_find_device_by_name - find a device by using it name
  *
@@ -101,6 +207,26 @@ struct region *platform_find_region_by_id(int id);
  */
 struct secure_device *platform_find_device_by_name(char *name);
 
+/**
+ * platform_get_device_handle - get the handle of a device
+ *
+ * @device: the device
+ *
+ * return a small integer identifying the device, to be used with
+ * platform_find_device_by_handle()
+ */
+uint32_t platform_get_device_handle(struct secure_device *device);
+
+/**
+ * platform_find_device_by_handle - find a device by using it handle
+ *
+ * @handle: the handle given by platform_get_device_handle()
+ *
+ * return a struct secure_device * if the device has been found
+ * else return NULL
+ */
+struct secure_device *platform_find_device_by_handle(uint32_t handle);
+
 /**
  * platform_check_permissions - check if the given device can have access
  * to a specific region
@@ -13,11 +13,33 @@
 #include <stdio.h>
 
 #include <tee_internal_api.h>
-#include <tee_internal_api_extensions.h>
 
 #include "ta_sdp.h"
 #include "sdp_platform_api.h"
-#include "string_ext.h"
+
+/* time spent in each command, reported by TA_SDP_GET_STATS */
+static struct sdp_ta_stats stats[SDP_NR_COMMANDS];
+
+/* pipelines registered with TA_SDP_REGISTER_PIPELINE */
+static struct sdp_pipeline_stage pipelines[SDP_MAX_PIPELINES]
+					 [SDP_MAX_PIPELINE_STAGES];
+static uint32_t pipeline_stages[SDP_MAX_PIPELINES];
+
+/* documented to the kernel users in host/include/smaf-optee.h */
+#define MAX_POOLS		8
+#define MAX_POOL_REGIONS	64
+
+/* regions kept by TA_SDP_POOL */
+struct pool {
+	bool used;
+	bool attached;
+	uint32_t id;
+	uint32_t generation;
+	uint32_t nb_regions;
+	uint32_t regions[MAX_POOL_REGIONS];
+};
+
+static struct pool pools[MAX_POOLS];
 
 /*
  * Called when the instance of the TA is created. This is the first call in
@@ -71,95 +93,631 @@ void TA_CloseSessionEntryPoint(void *sess_ctx)
 	IMSG("Goodbye SDP\n");
 }
 
+static struct pool *find_pool(uint32_t id, bool create)
+{
+	struct pool *free = NULL;
+	int i;
+
+	for (i = 0; i < MAX_POOLS; i++) {
+		if (pools[i].used && pools[i].id == id)
+			return &pools[i];
+		if (!pools[i].used && !free)
+			free = &pools[i];
+	}
+
+	if (!create || !free)
+		return NULL;
+
+	memset(free, 0, sizeof(*free));
+	free->used = true;
+	free->attached = true;
+	free->id = id;
+
+	return free;
+}
+
+static struct pool *region_pool(uint32_t region_id)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < MAX_POOLS; i++) {
+		if (!pools[i].used)
+			continue;
+
+		for (j = 0; j < pools[i].nb_regions; j++)
+			if (pools[i].regions[j] == region_id)
+				return &pools[i];
+	}
+
+	return NULL;
+}
+
+static TEE_Result do_destroy_region(uint32_t region_id)
+{
+	if (region_pool(region_id))
+		return TEE_ERROR_ACCESS_DENIED;
+
+	platform_destroy_region(region_id);
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result do_create_region(uint64_t addr, uint64_t size,
+				   uint32_t owner, uint32_t *id)
+{
+	int index;
+
+	/* the region must not wrap around the address space */
+	if (size == 0 || addr + size - 1 < addr)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	index = platform_create_region(addr, size);
+	if (index < 0)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	platform_set_region_owner(platform_find_region_by_id(index), owner);
+	*id = index;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result do_resize_region(uint32_t region_id, uint64_t addr,
+				   uint64_t size)
+{
+	struct region *region;
+
+	if (size == 0 || addr + size - 1 < addr)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	region = platform_find_region_by_id(region_id);
+	if (region == NULL) {
+		IMSG("Can't find region id %d\n", region_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (platform_resize_region(region, addr, size))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result do_update_region(uint32_t region_id, bool add,
+				   uint32_t handle, int dir)
+{
+	struct secure_device *device;
+	struct region *region;
+
+	device = platform_find_device_by_handle(handle);
+	if (device == 0) {
+		IMSG("Can't find device handle %d\n", handle);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	region = platform_find_region_by_id(region_id);
+	if (region == NULL) {
+		IMSG("Can't find region id %d\n", region_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (add) {
+		if (platform_check_permissions(region, device, dir)) {
+			IMSG("check permissions failed\n");
+			return TEE_ERROR_BAD_PARAMETERS;
+		}
+
+		platform_add_device_to_region(region, device, dir);
+	} else {
+		platform_remove_device_from_region(region, device);
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result do_apply_pipeline(uint32_t region_id, uint32_t pipeline)
+{
+	struct sdp_pipeline_stage *stages;
+	TEE_Result res;
+	uint32_t i;
+
+	if (pipeline >= SDP_MAX_PIPELINES || pipeline_stages[pipeline] == 0)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	stages = pipelines[pipeline];
+
+	/* a failed stage gives the devices back the access they had before */
+	platform_begin();
+
+	for (i = 0; i < pipeline_stages[pipeline]; i++) {
+		res = do_update_region(region_id, true, stages[i].device,
+				       stages[i].dir);
+		if (res != TEE_SUCCESS) {
+			platform_abort();
+			return res;
+		}
+	}
+
+	platform_commit();
+	return TEE_SUCCESS;
+}
+
 static TEE_Result create_region(uint32_t param_types, TEE_Param params[4])
 {
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 							TEE_PARAM_TYPE_VALUE_INPUT,
-							TEE_PARAM_TYPE_VALUE_OUTPUT,
+							TEE_PARAM_TYPE_VALUE_INOUT,
 							TEE_PARAM_TYPE_NONE);
-	uint64_t addr;
+	uint64_t addr, size;
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	addr = ((uint64_t)params[0].value.a << 32) | params[0].value.b;
+	size = ((uint64_t)params[1].value.a << 32) | params[1].value.b;
+
+	return do_create_region(addr, size, params[2].value.b,
+				&params[2].value.a);
+}
+
+static TEE_Result destroy_region(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	return do_destroy_region(params[0].value.a);
+}
+
+static TEE_Result update_region(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	return do_update_region(params[0].value.a, params[0].value.b,
+				params[1].value.a, params[2].value.a);
+}
+
+static TEE_Result resize_region(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_NONE);
+	uint64_t addr, size;
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	addr = ((uint64_t)params[1].value.a << 32) | params[1].value.b;
+	size = ((uint64_t)params[2].value.a << 32) | params[2].value.b;
+
+	return do_resize_region(params[0].value.a, addr, size);
+}
+
+static TEE_Result create_region_sg(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_INOUT,
+							TEE_PARAM_TYPE_NONE);
+	struct sdp_sg_entry *entries = params[0].memref.buffer;
+	struct platform_sg_entry *sg;
+	uint32_t count, i, handle;
+	TEE_Result res = TEE_ERROR_BAD_PARAMETERS;
 	int index;
 
 	if (param_types != exp_param_types) {
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	addr = params[0].value.b;
+	count = params[0].memref.size / sizeof(*entries);
+	if (count == 0 || count > SDP_MAX_SG_ENTRIES)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	sg = TEE_Malloc(count * sizeof(*sg), 0);
+	if (!sg)
+		return TEE_ERROR_OUT_OF_MEMORY;
 
-	index = platform_create_region(addr, params[1].value.a);
+	/* read the shared memory once, the host could change it meanwhile */
+	for (i = 0; i < count; i++) {
+		struct sdp_sg_entry entry;
+
+		memcpy(&entry, &entries[i], sizeof(entry));
+		sg[i].addr = ((uint64_t)entry.addr_msb << 32) | entry.addr_lsb;
+		sg[i].size = ((uint64_t)entry.size_msb << 32) | entry.size_lsb;
+
+		if (sg[i].size == 0 || sg[i].addr + sg[i].size - 1 < sg[i].addr)
+			goto out;
+	}
+
+	index = platform_create_region_sg(sg, count);
 	if (index < 0)
-		return TEE_ERROR_BAD_PARAMETERS;
+		goto out;
+
+	platform_set_region_owner(platform_find_region_by_id(index),
+				  params[2].value.b);
+
+	handle = params[1].value.a;
+	if (handle != SDP_NO_DEVICE) {
+		res = do_update_region(index, true, handle, params[1].value.b);
+		if (res != TEE_SUCCESS) {
+			platform_destroy_region(index);
+			goto out;
+		}
+	}
 
 	params[2].value.a = index;
+	res = TEE_SUCCESS;
+
+out:
+	TEE_Free(sg);
+	return res;
+}
+
+static TEE_Result register_pipeline(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+	struct sdp_pipeline_stage stages[SDP_MAX_PIPELINE_STAGES];
+	uint32_t pipeline, count, i;
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	pipeline = params[1].value.a;
+	count = params[0].memref.size / sizeof(stages[0]);
+	if (pipeline >= SDP_MAX_PIPELINES || count > SDP_MAX_PIPELINE_STAGES)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	memcpy(stages, params[0].memref.buffer, count * sizeof(stages[0]));
+
+	for (i = 0; i < count; i++) {
+		if (platform_find_device_by_handle(stages[i].device) == 0 ||
+		    stages[i].dir > DIR_WRITE)
+			return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	memcpy(pipelines[pipeline], stages, count * sizeof(stages[0]));
+	pipeline_stages[pipeline] = count;
 
 	return TEE_SUCCESS;
 }
 
-static TEE_Result destroy_region(uint32_t param_types, TEE_Param params[4])
+static TEE_Result apply_pipeline(uint32_t param_types, TEE_Param params[4])
 {
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 							TEE_PARAM_TYPE_NONE,
 							TEE_PARAM_TYPE_NONE,
 							TEE_PARAM_TYPE_NONE);
-	uint32_t id;
 
 	if (param_types != exp_param_types) {
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	id = params[0].value.a;
-	platform_destroy_region(id);
+	return do_apply_pipeline(params[0].value.a, params[0].value.b);
+}
+
+static TEE_Result pool_add_region(struct pool *pool, uint32_t region_id)
+{
+	if (!pool->attached)
+		return TEE_ERROR_BAD_STATE;
+	if (!platform_find_region_by_id(region_id) || region_pool(region_id))
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (pool->nb_regions >= MAX_POOL_REGIONS)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	/* the pool outlives the creator of the region */
+	platform_set_region_owner(platform_find_region_by_id(region_id),
+				  SDP_NO_OWNER);
+	pool->regions[pool->nb_regions++] = region_id;
 
 	return TEE_SUCCESS;
 }
 
-static TEE_Result update_region(uint32_t param_types, TEE_Param params[4])
+static TEE_Result pool_control(uint32_t param_types, TEE_Param params[4])
 {
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
-							TEE_PARAM_TYPE_MEMREF_INPUT,
 							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_OUTPUT,
 							TEE_PARAM_TYPE_NONE);
-	uint32_t region_id;
-	bool add;
-	int dir;
-	char *name;
-	struct secure_device *device;
-	struct region *region;
+	struct pool *pool;
+	uint32_t op, value, i;
+	TEE_Result res;
+	bool created;
 
 	if (param_types != exp_param_types) {
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	region_id = params[0].value.a;
-	add = params[0].value.b;
+	op = params[0].value.a;
+	value = params[1].value.a;
+
+	pool = find_pool(params[0].value.b, false);
+	created = !pool && op == SDP_POOL_ADD;
+	if (created)
+		pool = find_pool(params[0].value.b, true);
+	if (!pool)
+		return op == SDP_POOL_ADD ? TEE_ERROR_OUT_OF_MEMORY :
+					    TEE_ERROR_ITEM_NOT_FOUND;
+
+	switch (op) {
+	case SDP_POOL_ADD:
+		res = pool_add_region(pool, value);
+		if (res != TEE_SUCCESS) {
+			/* a pool created for nothing gives its slot back */
+			if (created)
+				memset(pool, 0, sizeof(*pool));
+			return res;
+		}
+		break;
+	case SDP_POOL_ATTACH:
+		if (pool->attached || pool->generation != value)
+			return TEE_ERROR_BAD_STATE;
+		pool->attached = true;
+		pool->generation++;
+		break;
+	case SDP_POOL_DETACH:
+		if (!pool->attached || pool->generation != value)
+			return TEE_ERROR_BAD_STATE;
+		pool->attached = false;
+		break;
+	case SDP_POOL_RELEASE:
+		if (pool->attached)
+			return TEE_ERROR_BAD_STATE;
+		for (i = 0; i < pool->nb_regions; i++)
+			platform_destroy_region(pool->regions[i]);
+		memset(pool, 0, sizeof(*pool));
+		break;
+	default:
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
 
-	name = params[1].memref.buffer;
+	params[2].value.a = pool->generation;
 
-	dir = params[2].value.a;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result destroy_all(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_OUTPUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (params[0].value.a == SDP_NO_OWNER)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	params[1].value.a = platform_destroy_owner_regions(params[0].value.a);
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result lookup_addr(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_VALUE_OUTPUT,
+							TEE_PARAM_TYPE_VALUE_OUTPUT,
+							TEE_PARAM_TYPE_NONE);
+	uint64_t addr;
+	int id;
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	addr = ((uint64_t)params[0].value.a << 32) | params[0].value.b;
+
+	id = platform_find_region_by_addr(addr);
+	if (id < 0)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	params[1].value.a = id;
+	platform_get_region_access(platform_find_region_by_id(id),
+				   &params[2].value.a, &params[2].value.b);
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result resolve_device(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+							TEE_PARAM_TYPE_VALUE_OUTPUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+	char name[MAX_NAME_SIZE];
+	struct secure_device *device;
+	uint32_t size;
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	size = params[0].memref.size;
+	if (size == 0 || size > sizeof(name))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	memcpy(name, params[0].memref.buffer, size);
+	name[size - 1] = '\0';
 
 	device = platform_find_device_by_name(name);
 	if (device == 0) {
 		IMSG("Can't find device %s\n", name);
+		return TEE_ERROR_ITEM_NOT_FOUND;
+	}
+
+	params[1].value.a = platform_get_device_handle(device);
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Resolve the region targeted by a batch entry, following references to
+ * regions created by previous entries of the same batch. created holds the
+ * regions created by the entries before index, SDP_BATCH_ID_REF for the
+ * entries which didn't create one.
+ */
+static TEE_Result batch_entry_region(const uint32_t *created, uint32_t index,
+				     uint32_t id, uint32_t *region_id)
+{
+	uint32_t ref;
+
+	if (!(id & SDP_BATCH_ID_REF)) {
+		*region_id = id;
+		return TEE_SUCCESS;
+	}
+
+	ref = id & ~SDP_BATCH_ID_REF;
+	if (ref >= index || created[ref] == SDP_BATCH_ID_REF)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	*region_id = created[ref];
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result run_batch_entry(struct sdp_batch_entry *entry,
+				  uint32_t region_id)
+{
+	switch (entry->cmd) {
+	case TA_SDP_CREATE_REGION:
+		return do_create_region(
+			((uint64_t)entry->addr_msb << 32) | entry->addr_lsb,
+			((uint64_t)entry->size_msb << 32) | entry->size_lsb,
+			entry->owner, &entry->id);
+	case TA_SDP_DESTROY_REGION:
+		return do_destroy_region(region_id);
+	case TA_SDP_UPDATE_REGION:
+		return do_update_region(region_id, entry->add, entry->device,
+					entry->dir);
+	case TA_SDP_RESIZE_REGION:
+		return do_resize_region(region_id,
+			((uint64_t)entry->addr_msb << 32) | entry->addr_lsb,
+			((uint64_t)entry->size_msb << 32) | entry->size_lsb);
+	case TA_SDP_APPLY_PIPELINE:
+		return do_apply_pipeline(region_id, entry->device);
+	default:
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
+}
 
-	region = platform_find_region_by_id(region_id);
-	if (region == NULL) {
-		IMSG("Can't find region id %d\n", region_id);
+static TEE_Result batch(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INOUT,
+							TEE_PARAM_TYPE_VALUE_INPUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+	struct sdp_batch_entry *entries;
+	struct sdp_batch_entry entry;
+	uint32_t count, i, region_id;
+	uint32_t *created;
+	TEE_Result res;
+
+	if (param_types != exp_param_types) {
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (add) {
-		if (platform_check_permissions(region, device, dir)) {
-			IMSG("check permissions failed\n");
-			return TEE_ERROR_BAD_PARAMETERS;
-		}
+	entries = params[0].memref.buffer;
+	count = params[1].value.a;
 
-		platform_add_device_to_region(region, device, dir);
-	} else {
-		platform_remove_device_from_region(region, device);
+	if (count > params[0].memref.size / sizeof(*entries))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (!count)
+		return TEE_SUCCESS;
+
+	/* references are resolved from here, never from the shared buffer */
+	created = TEE_Malloc(count * sizeof(*created), 0);
+	if (!created)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	for (i = 0; i < count; i++) {
+		/* work on a copy, the shared buffer can change under our feet */
+		memcpy(&entry, &entries[i], sizeof(entry));
+
+		res = TEE_SUCCESS;
+		region_id = 0;
+		if (entry.cmd != TA_SDP_CREATE_REGION)
+			res = batch_entry_region(created, i, entry.id,
+						 &region_id);
+		if (res == TEE_SUCCESS)
+			res = run_batch_entry(&entry, region_id);
+
+		created[i] = SDP_BATCH_ID_REF;
+		if (entry.cmd == TA_SDP_CREATE_REGION && res == TEE_SUCCESS)
+			created[i] = entry.id;
+
+		entries[i].id = entry.id;
+		entries[i].status = res;
+	}
+
+	TEE_Free(created);
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result ring_drain(uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INOUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+	struct sdp_ring *ring;
+	struct sdp_batch_entry entry;
+	struct sdp_batch_entry *slot;
+	uint32_t nb, head, tail;
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	ring = params[0].memref.buffer;
+	if (params[0].memref.size < sizeof(*ring))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* the host keeps writing the ring, read the indexes only once */
+	nb = ring->size;
+	head = ring->head;
+	tail = ring->tail;
+
+	if (!nb || (nb & (nb - 1)) ||
+	    nb > (params[0].memref.size - sizeof(*ring)) / sizeof(entry) ||
+	    tail - head > nb)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	for (; head != tail; head++) {
+		slot = &ring->entries[head & (nb - 1)];
+		memcpy(&entry, slot, sizeof(entry));
+
+		/* entries of the ring can't refer to each other */
+		if (entry.id & SDP_BATCH_ID_REF)
+			slot->status = TEE_ERROR_BAD_PARAMETERS;
+		else
+			slot->status = run_batch_entry(&entry, entry.id);
+
+		slot->id = entry.id;
 	}
 
+	ring->head = head;
+
 	return TEE_SUCCESS;
 }
 
@@ -178,17 +736,31 @@ static TEE_Result dump_status(uint32_t param_types, TEE_Param params[4])
 	return TEE_SUCCESS;
 }
 
-/*
- * Called when a TA is invoked. sess_ctx hold that value that was
- * assigned by TA_OpenSessionEntryPoint(). The rest of the paramters
- * comes from normal world.
- */
-TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
-			uint32_t param_types, TEE_Param params[4])
+static TEE_Result get_stats(uint32_t param_types, TEE_Param params[4])
 {
-	(void)&sess_ctx; /* Unused parameter */
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE,
+							TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
 
+	if (params[0].memref.size < sizeof(stats)) {
+		params[0].memref.size = sizeof(stats);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	memcpy(params[0].memref.buffer, stats, sizeof(stats));
+	params[0].memref.size = sizeof(stats);
 
+	return TEE_SUCCESS;
+}
+
+static TEE_Result invoke_command(uint32_t cmd_id, uint32_t param_types,
+				 TEE_Param params[4])
+{
 	switch (cmd_id) {
 	case TA_SDP_CREATE_REGION:
 		return create_region(param_types, params);
@@ -198,7 +770,81 @@ TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
 		return update_region(param_types, params);
 	case TA_SDP_DUMP_STATUS:
 		return dump_status(param_types, params);
+	case TA_SDP_BATCH:
+		return batch(param_types, params);
+	case TA_SDP_RESOLVE_DEVICE:
+		return resolve_device(param_types, params);
+	case TA_SDP_RING_DRAIN:
+		return ring_drain(param_types, params);
+	case TA_SDP_GET_STATS:
+		return get_stats(param_types, params);
+	case TA_SDP_CREATE_REGION_SG:
+		return create_region_sg(param_types, params);
+	case TA_SDP_RESIZE_REGION:
+		return resize_region(param_types, params);
+	case TA_SDP_REGISTER_PIPELINE:
+		return register_pipeline(param_types, params);
+	case TA_SDP_APPLY_PIPELINE:
+		return apply_pipeline(param_types, params);
+	case TA_SDP_POOL:
+		return pool_control(param_types, params);
+	case TA_SDP_DESTROY_ALL:
+		return destroy_all(param_types, params);
+	case TA_SDP_LOOKUP_ADDR:
+		return lookup_addr(param_types, params);
 	default:
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 }
+
+static uint32_t time_to_us(TEE_Time *time)
+{
+	return time->seconds * 1000000 + time->millis * 1000;
+}
+
+/*
+ * Called when a TA is invoked. sess_ctx hold that value that was
+ * assigned by TA_OpenSessionEntryPoint(). The rest of the paramters
+ * comes from normal world.
+ */
+TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
+			uint32_t param_types, TEE_Param params[4])
+{
+	TEE_Time start, end;
+	TEE_Result res;
+	uint32_t elapsed;
+	bool timed;
+
+	(void)&sess_ctx; /* Unused parameter */
+
+	/* the optional timing parameter isn't seen by the commands */
+	timed = TEE_PARAM_TYPE_GET(param_types, 3) ==
+		TEE_PARAM_TYPE_VALUE_OUTPUT;
+	if (timed)
+		param_types &= ~TEE_PARAM_TYPES(0, 0, 0, 0xF);
+
+	TEE_GetSystemTime(&start);
+
+	/* all the changes of a command are applied with one commit */
+	platform_begin();
+	res = invoke_command(cmd_id, param_types, params);
+	if (res != TEE_SUCCESS)
+		platform_abort();
+	else if (platform_commit())
+		res = TEE_ERROR_GENERIC;
+
+	TEE_GetSystemTime(&end);
+
+	/* the system time has a millisecond resolution */
+	elapsed = time_to_us(&end) - time_to_us(&start);
+
+	if (cmd_id < SDP_NR_COMMANDS) {
+		stats[cmd_id].calls++;
+		stats[cmd_id].time_us += elapsed;
+	}
+
+	if (timed)
+		params[3].value.a = elapsed;
+
+	return res;
+}
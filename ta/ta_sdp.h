@@ -1,20 +1,32 @@
 #ifndef TA_SDP_H
 #define TA_SDP_H
 
+#include <stdint.h>
+
 /* This UUID is generated with uuidgen
    the ITU-T UUID generator at http://www.itu.int/ITU-T/asn1/uuid.html */
 #define TA_SDP_UUID { 0xb9aa5f00, 0xd229, 0x11e4, \
 		{ 0x92, 0x5c, 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b} }
 
+/*
+ * All commands accept an optional 4th parameter, when params[3] is
+ * TEE_PARAM_TYPE_VALUE_OUTPUT the TA returns in it the time it spent
+ * handling the command:
+ *		params[3].value.a: handling time in microseconds
+ */
+
 /**
  * TA_SDP_CREATE_REGION have 3 parameters:
  * - TEE_PARAM_TYPE_VALUE_INPUT
- *      param[0].value.a: memory region address MSB (to be tested for 64bits)
- *      param[0].value.b: memory region address LSB
+ *		param[0].value.a: memory region address MSB
+ *		param[0].value.b: memory region address LSB
  * - TEE_PARAM_TYPE_VALUE_INPUT
- *		param[1].value.a: size of the memory region
- * - TEE_PARAM_TYPE_VALUE_OUTPUT
- *		param[2].value.a: region identifier
+ *		param[1].value.a: size of the memory region MSB
+ *		param[1].value.b: size of the memory region LSB
+ * - TEE_PARAM_TYPE_VALUE_INOUT
+ *		param[2].value.a: region identifier (output)
+ *		param[2].value.b: owner of the region, see TA_SDP_DESTROY_ALL
+ *		(input)
  */
 #define TA_SDP_CREATE_REGION    0
 
@@ -22,6 +34,8 @@
  * TA_SDP_DESTROY_REGION have 1 parameter:
  * - TEE_PARAM_TYPE_VALUE_INPUT
  *		param[0].value.a: region identifier
+ *
+ * The regions of a pool are only destroyed with the pool.
  */
 #define TA_SDP_DESTROY_REGION   1
 
@@ -31,9 +45,8 @@
  *		param[0].value.a: region identifier
  *		param[0].value.b: inditicated if the permissions have to be added or
  *		removed to the memory region
- * - TEE_PARAM_TYPE_MEMREF_INPUT
- *		params[1].memref.buffer: the device name
- *		params[1].memref.size: lenght of the string
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[1].value.a: device handle given by TA_SDP_RESOLVE_DEVICE
  * - TEE_PARAM_TYPE_VALUE_INPUT
  *		params[2].value.a: access request direction (read/write)
  */
@@ -47,4 +60,265 @@
  */
 #define TA_SDP_DUMP_STATUS		3
 
+/*
+ * TA_SDP_BATCH have 2 parameters
+ * - TEE_PARAM_TYPE_MEMREF_INOUT
+ *		params[0].memref.buffer: array of struct sdp_batch_entry
+ *		params[0].memref.size: size of the array in bytes
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[1].value.a: number of entries in the array
+ *
+ * Entries are processed in order and each one gets its own status, a failing
+ * entry doesn't stop the following ones.
+ */
+#define TA_SDP_BATCH			4
+
+/*
+ * When set in sdp_batch_entry.id the lower bits are the index of a previous
+ * TA_SDP_CREATE_REGION entry of the same batch whose region is targeted
+ */
+#define SDP_BATCH_ID_REF	(1U << 31)
+
+/**
+ * struct sdp_batch_entry - one operation of a TA_SDP_BATCH command
+ *
+ * @cmd: TA_SDP_CREATE_REGION, TA_SDP_DESTROY_REGION, TA_SDP_UPDATE_REGION,
+ *	 TA_SDP_RESIZE_REGION or TA_SDP_APPLY_PIPELINE
+ * @id: region identifier, set by the TA for TA_SDP_CREATE_REGION
+ * @addr_msb: memory region address MSB (create and resize only)
+ * @addr_lsb: memory region address LSB (create and resize only)
+ * @size_msb: size of the memory region MSB (create and resize only)
+ * @size_lsb: size of the memory region LSB (create and resize only)
+ * @add: permissions have to be added or removed (update only)
+ * @dir: access request direction (update only)
+ * @device: device handle (update only), pipeline identifier (apply only)
+ * @owner: owner of the region (create only)
+ * @status: TEE_Result of the operation, set by the TA
+ */
+struct sdp_batch_entry {
+	uint32_t cmd;
+	uint32_t id;
+	uint32_t addr_msb;
+	uint32_t addr_lsb;
+	uint32_t size_msb;
+	uint32_t size_lsb;
+	uint32_t add;
+	uint32_t dir;
+	uint32_t device;
+	uint32_t owner;
+	uint32_t status;
+};
+
+/*
+ * TA_SDP_RESOLVE_DEVICE have 2 parameters
+ * - TEE_PARAM_TYPE_MEMREF_INPUT
+ *		params[0].memref.buffer: the device name
+ *		params[0].memref.size: lenght of the string
+ * - TEE_PARAM_TYPE_VALUE_OUTPUT
+ *		params[1].value.a: device handle, stable for the TA lifetime
+ */
+#define TA_SDP_RESOLVE_DEVICE	5
+
+/*
+ * TA_SDP_RING_DRAIN have 1 parameter
+ * - TEE_PARAM_TYPE_MEMREF_INOUT
+ *		params[0].memref.buffer: struct sdp_ring in shared memory
+ *		params[0].memref.size: size of the ring
+ *
+ * Process all the entries queued in the ring, from head to tail, store
+ * their status and move head forward. The entries can't use
+ * SDP_BATCH_ID_REF.
+ */
+#define TA_SDP_RING_DRAIN	6
+
+/**
+ * struct sdp_ring - submission ring shared with the host
+ *
+ * @size: number of entries, a power of two
+ * @head: index of the next entry to be processed, written by the TA
+ * @tail: index of the next free entry, written by the host
+ * @reserved: padding
+ * @entries: the entries, an index is used modulo @size
+ *
+ * Entries between the previous and the new head are completed when
+ * TA_SDP_RING_DRAIN returns, with their status set.
+ */
+struct sdp_ring {
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t reserved;
+	struct sdp_batch_entry entries[];
+};
+
+/*
+ * TA_SDP_GET_STATS have 1 parameter
+ * - TEE_PARAM_TYPE_MEMREF_OUTPUT
+ *		params[0].memref.buffer: array of struct sdp_ta_stats indexed by
+ *		command identifier
+ *		params[0].memref.size: size of the array in bytes, updated with
+ *		the size used
+ */
+#define TA_SDP_GET_STATS	7
+
+/*
+ * TA_SDP_CREATE_REGION_SG have 3 parameters
+ * - TEE_PARAM_TYPE_MEMREF_INPUT
+ *		params[0].memref.buffer: array of struct sdp_sg_entry
+ *		params[0].memref.size: size of the array in bytes
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[1].value.a: device handle to be given access to the
+ *		region, SDP_NO_DEVICE for none
+ *		params[1].value.b: access request direction (read/write)
+ * - TEE_PARAM_TYPE_VALUE_INOUT
+ *		params[2].value.a: region identifier (output)
+ *		params[2].value.b: owner of the region (input)
+ *
+ * The entries make a single region with one set of permissions. The region
+ * isn't created if the access can't be granted.
+ */
+#define TA_SDP_CREATE_REGION_SG	8
+
+/*
+ * TA_SDP_RESIZE_REGION have 3 parameters
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[0].value.a: region identifier
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[1].value.a: new memory region address MSB
+ *		params[1].value.b: new memory region address LSB
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[2].value.a: new size of the memory region MSB
+ *		params[2].value.b: new size of the memory region LSB
+ *
+ * Move the bounds of a region made of one part, its permissions apply to
+ * the new bounds. Used to merge adjacent regions and to split them again.
+ */
+#define TA_SDP_RESIZE_REGION	9
+
+/*
+ * TA_SDP_REGISTER_PIPELINE have 2 parameters
+ * - TEE_PARAM_TYPE_MEMREF_INPUT
+ *		params[0].memref.buffer: array of struct sdp_pipeline_stage, in
+ *		the order the devices access the buffers
+ *		params[0].memref.size: size of the array in bytes, 0 to
+ *		unregister the pipeline
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[1].value.a: pipeline identifier, below
+ *		SDP_MAX_PIPELINES, chosen by the caller
+ *
+ * A pipeline replaces the previous one registered with the same identifier.
+ */
+#define TA_SDP_REGISTER_PIPELINE	10
+
+/*
+ * TA_SDP_APPLY_PIPELINE have 1 parameter
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[0].value.a: region identifier
+ *		params[0].value.b: pipeline identifier
+ *
+ * Give each device of the pipeline access to the region, in the pipeline
+ * order. If a stage fails the devices of the previous stages get back the
+ * access they had to the region before.
+ */
+#define TA_SDP_APPLY_PIPELINE		11
+
+/*
+ * TA_SDP_POOL have 3 parameters
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[0].value.a: operation, one of SDP_POOL_*
+ *		params[0].value.b: pool identifier
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[1].value.a: region identifier for SDP_POOL_ADD,
+ *		current generation for SDP_POOL_ATTACH and SDP_POOL_DETACH
+ * - TEE_PARAM_TYPE_VALUE_OUTPUT
+ *		params[2].value.a: generation of the pool
+ *
+ * A pool keeps its regions and their permissions while no client uses it.
+ * - SDP_POOL_ADD: add a region to an attached pool, the pool is created
+ *   attached with generation 0 if needed, the region loses its owner
+ * - SDP_POOL_ATTACH: attach a detached pool, its generation is bumped
+ * - SDP_POOL_DETACH: detach an attached pool
+ * - SDP_POOL_RELEASE: destroy a detached pool and its regions
+ */
+#define TA_SDP_POOL			12
+
+#define SDP_POOL_ADD		0
+#define SDP_POOL_ATTACH		1
+#define SDP_POOL_DETACH		2
+#define SDP_POOL_RELEASE	3
+
+/*
+ * TA_SDP_DESTROY_ALL have 2 parameters
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[0].value.a: owner, not SDP_NO_OWNER
+ * - TEE_PARAM_TYPE_VALUE_OUTPUT
+ *		params[1].value.a: number of regions destroyed
+ *
+ * Destroy all the regions created with this owner.
+ */
+#define TA_SDP_DESTROY_ALL		13
+
+/*
+ * TA_SDP_LOOKUP_ADDR have 3 parameters
+ * - TEE_PARAM_TYPE_VALUE_INPUT
+ *		params[0].value.a: physical address MSB
+ *		params[0].value.b: physical address LSB
+ * - TEE_PARAM_TYPE_VALUE_OUTPUT
+ *		params[1].value.a: identifier of the region covering the address
+ * - TEE_PARAM_TYPE_VALUE_OUTPUT
+ *		params[2].value.a: devices which can read, bit n for handle n
+ *		params[2].value.b: devices which can write, bit n for handle n
+ *
+ * Return TEE_ERROR_ITEM_NOT_FOUND if no region covers the address.
+ */
+#define TA_SDP_LOOKUP_ADDR		14
+
+#define SDP_NR_COMMANDS		(TA_SDP_LOOKUP_ADDR + 1)
+
+/* owner of the regions not destroyed by TA_SDP_DESTROY_ALL */
+#define SDP_NO_OWNER		0
+
+#define SDP_MAX_PIPELINES	8
+#define SDP_MAX_PIPELINE_STAGES	8
+
+/**
+ * struct sdp_pipeline_stage - a device of a pipeline
+ *
+ * @device: device handle
+ * @dir: access direction of the device
+ */
+struct sdp_pipeline_stage {
+	uint32_t device;
+	uint32_t dir;
+};
+
+#define SDP_MAX_SG_ENTRIES	64
+#define SDP_NO_DEVICE		0xFFFFFFFF
+
+/**
+ * struct sdp_sg_entry - one contiguous part of a scatter-gather region
+ *
+ * @addr_msb: address MSB
+ * @addr_lsb: address LSB
+ * @size_msb: size MSB
+ * @size_lsb: size LSB
+ */
+struct sdp_sg_entry {
+	uint32_t addr_msb;
+	uint32_t addr_lsb;
+	uint32_t size_msb;
+	uint32_t size_lsb;
+};
+
+/**
+ * struct sdp_ta_stats - cumulated statistics of a command in the TA
+ *
+ * @calls: number of calls
+ * @time_us: time spent handling the command
+ */
+struct sdp_ta_stats {
+	uint64_t calls;
+	uint64_t time_us;
+};
+
 #endif /*TA_SDP_H*/
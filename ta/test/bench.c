@@ -0,0 +1,411 @@
+/*
+ * bench.c
+ *
+ * Microbenchmark of the TA core built in userspace. The region commands are
+ * timed through TA_InvokeCommandEntryPoint() at several numbers of regions,
+ * up to the size of the regions table, and the results can be checked
+ * against stored thresholds.
+ *
+ * License terms: Lesser GNU General Public License (LGPL), version 2.1
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tee_internal_api.h>
+
+#include "ta_sdp.h"
+#include "sdp_platform_api.h"
+
+#ifndef CFG_SDP_MAX_REGIONS
+#define CFG_SDP_MAX_REGIONS 128
+#endif
+
+/* each measure runs at least this many operations */
+#define MIN_OPS		20000
+#define REGION_SIZE	0x10000
+#define DUMP_SIZE	(64 * 1024)
+
+enum bench_op {
+	OP_CREATE,
+	OP_GRANT,
+	OP_REVOKE,
+	OP_DUMP,
+	OP_DESTROY,
+	NR_OPS,
+};
+
+static const char * const op_names[NR_OPS] = {
+	[OP_CREATE]	= "create",
+	[OP_GRANT]	= "grant",
+	[OP_REVOKE]	= "revoke",
+	[OP_DUMP]	= "dump",
+	[OP_DESTROY]	= "destroy",
+};
+
+struct result {
+	enum bench_op op;
+	unsigned int regions;
+	uint64_t ops;
+	uint64_t ns;
+};
+
+static const unsigned int region_counts[] = { 1, 8, 32, CFG_SDP_MAX_REGIONS };
+
+#define MAX_RESULTS	(NR_OPS * sizeof(region_counts) / sizeof(*region_counts))
+
+static struct result results[MAX_RESULTS];
+static unsigned int nb_results;
+
+static uint32_t ids[CFG_SDP_MAX_REGIONS];
+static char dump[DUMP_SIZE];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static TEE_Result invoke(uint32_t cmd, uint32_t param_types,
+			 TEE_Param params[4])
+{
+	return TA_InvokeCommandEntryPoint(NULL, cmd, param_types, params);
+}
+
+static int resolve_device(const char *name, uint32_t *handle)
+{
+	TEE_Param params[4];
+
+	memset(params, 0, sizeof(params));
+	params[0].memref.buffer = (void *)name;
+	params[0].memref.size = strlen(name) + 1;
+
+	if (invoke(TA_SDP_RESOLVE_DEVICE,
+		   TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				   TEE_PARAM_TYPE_VALUE_OUTPUT,
+				   TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE),
+		   params) != TEE_SUCCESS)
+		return -1;
+
+	*handle = params[1].value.a;
+	return 0;
+}
+
+static int create_region(uint64_t addr, uint64_t size, uint32_t *id)
+{
+	TEE_Param params[4];
+
+	memset(params, 0, sizeof(params));
+	params[0].value.a = addr >> 32;
+	params[0].value.b = addr;
+	params[1].value.a = size >> 32;
+	params[1].value.b = size;
+
+	if (invoke(TA_SDP_CREATE_REGION,
+		   TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				   TEE_PARAM_TYPE_VALUE_INPUT,
+				   TEE_PARAM_TYPE_VALUE_INOUT,
+				   TEE_PARAM_TYPE_NONE),
+		   params) != TEE_SUCCESS)
+		return -1;
+
+	*id = params[2].value.a;
+	return 0;
+}
+
+static int update_region(uint32_t id, int add, uint32_t handle, uint32_t dir)
+{
+	TEE_Param params[4];
+
+	memset(params, 0, sizeof(params));
+	params[0].value.a = id;
+	params[0].value.b = add;
+	params[1].value.a = handle;
+	params[2].value.a = dir;
+
+	return invoke(TA_SDP_UPDATE_REGION,
+		      TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				      TEE_PARAM_TYPE_VALUE_INPUT,
+				      TEE_PARAM_TYPE_VALUE_INPUT,
+				      TEE_PARAM_TYPE_NONE),
+		      params) == TEE_SUCCESS ? 0 : -1;
+}
+
+static int destroy_region(uint32_t id)
+{
+	TEE_Param params[4];
+
+	memset(params, 0, sizeof(params));
+	params[0].value.a = id;
+
+	return invoke(TA_SDP_DESTROY_REGION,
+		      TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				      TEE_PARAM_TYPE_NONE,
+				      TEE_PARAM_TYPE_NONE,
+				      TEE_PARAM_TYPE_NONE),
+		      params) == TEE_SUCCESS ? 0 : -1;
+}
+
+static int dump_status(void)
+{
+	TEE_Param params[4];
+
+	memset(params, 0, sizeof(params));
+	params[0].memref.buffer = dump;
+	params[0].memref.size = sizeof(dump);
+
+	return invoke(TA_SDP_DUMP_STATUS,
+		      TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				      TEE_PARAM_TYPE_NONE,
+				      TEE_PARAM_TYPE_NONE,
+				      TEE_PARAM_TYPE_NONE),
+		      params) == TEE_SUCCESS ? 0 : -1;
+}
+
+static struct result *result_get(enum bench_op op, unsigned int regions)
+{
+	unsigned int i;
+
+	for (i = 0; i < nb_results; i++)
+		if (results[i].op == op && results[i].regions == regions)
+			return &results[i];
+
+	results[nb_results].op = op;
+	results[nb_results].regions = regions;
+	return &results[nb_results++];
+}
+
+static void account(enum bench_op op, unsigned int regions, uint64_t ops,
+		    uint64_t start)
+{
+	struct result *result = result_get(op, regions);
+
+	result->ops += ops;
+	result->ns += now_ns() - start;
+}
+
+/* one round: all the regions go through each command in turn */
+static int run_round(unsigned int regions, uint32_t handle)
+{
+	uint64_t start;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < regions; i++)
+		if (create_region((uint64_t)i * REGION_SIZE, REGION_SIZE,
+				  &ids[i]))
+			return -1;
+	account(OP_CREATE, regions, regions, start);
+
+	start = now_ns();
+	for (i = 0; i < regions; i++)
+		if (update_region(ids[i], 1, handle, DIR_WRITE))
+			return -1;
+	account(OP_GRANT, regions, regions, start);
+
+	start = now_ns();
+	if (dump_status())
+		return -1;
+	account(OP_DUMP, regions, 1, start);
+
+	start = now_ns();
+	for (i = 0; i < regions; i++)
+		if (update_region(ids[i], 0, handle, DIR_WRITE))
+			return -1;
+	account(OP_REVOKE, regions, regions, start);
+
+	start = now_ns();
+	for (i = 0; i < regions; i++)
+		if (destroy_region(ids[i]))
+			return -1;
+	account(OP_DESTROY, regions, regions, start);
+
+	return 0;
+}
+
+static double ns_per_op(const struct result *result)
+{
+	return (double)result->ns / result->ops;
+}
+
+static void print_results(void)
+{
+	unsigned int i;
+
+	printf("%-8s %8s %12s %10s\n", "command", "regions", "ops/s", "ns/op");
+	for (i = 0; i < nb_results; i++)
+		printf("%-8s %8u %12.0f %10.1f\n", op_names[results[i].op],
+		       results[i].regions, 1e9 / ns_per_op(&results[i]),
+		       ns_per_op(&results[i]));
+}
+
+static int parse_op(const char *name, enum bench_op *op)
+{
+	int i;
+
+	for (i = 0; i < NR_OPS; i++) {
+		if (!strcmp(op_names[i], name)) {
+			*op = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Thresholds file: one "command regions max_ns_per_op" line per result to
+ * check, '#' starts a comment. Return the number of regressions or -1.
+ */
+static int check_thresholds(const char *path)
+{
+	char line[128], name[32];
+	unsigned int regions, i;
+	double max;
+	enum bench_op op;
+	int regressions = 0;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%31s %u %lf", name, &regions, &max) != 3 ||
+		    parse_op(name, &op)) {
+			fprintf(stderr, "%s: bad line: %s", path, line);
+			regressions = -1;
+			break;
+		}
+
+		for (i = 0; i < nb_results; i++) {
+			if (results[i].op != op || results[i].regions != regions)
+				continue;
+
+			if (ns_per_op(&results[i]) > max) {
+				printf("regression: %s with %u regions takes %.1f ns/op, threshold %.1f\n",
+				       name, regions, ns_per_op(&results[i]),
+				       max);
+				regressions++;
+			}
+		}
+	}
+
+	fclose(file);
+	return regressions;
+}
+
+static int write_thresholds(const char *path, double margin)
+{
+	unsigned int i;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	fprintf(file, "# command regions max_ns_per_op, measured x%.1f\n",
+		margin);
+	for (i = 0; i < nb_results; i++)
+		fprintf(file, "%s %u %.0f\n", op_names[results[i].op],
+			results[i].regions, ns_per_op(&results[i]) * margin);
+
+	fclose(file);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-t thresholds] [-w thresholds] [-m margin]\n"
+		"  -t: fail if a result is slower than its threshold\n"
+		"  -w: write the results times the margin as thresholds\n"
+		"  -m: margin of -w (default: 4)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *check = NULL, *write = NULL;
+	double margin = 4;
+	unsigned int i, rounds, round, regions;
+	uint32_t handle;
+	TEE_Param params[4];
+	void *session;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "t:w:m:h")) != -1) {
+		switch (opt) {
+		case 't':
+			check = optarg;
+			break;
+		case 'w':
+			write = optarg;
+			break;
+		case 'm':
+			margin = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	memset(params, 0, sizeof(params));
+	if (TA_CreateEntryPoint() != TEE_SUCCESS ||
+	    TA_OpenSessionEntryPoint(0, params, &session) != TEE_SUCCESS) {
+		fprintf(stderr, "failed to start the TA\n");
+		return 2;
+	}
+
+	if (resolve_device("delta", &handle)) {
+		fprintf(stderr, "failed to resolve device\n");
+		return 2;
+	}
+
+	for (i = 0; i < sizeof(region_counts) / sizeof(*region_counts); i++) {
+		regions = region_counts[i];
+		if (regions > CFG_SDP_MAX_REGIONS ||
+		    (i && regions <= region_counts[i - 1]))
+			continue;
+
+		rounds = (MIN_OPS + regions - 1) / regions;
+		for (round = 0; round < rounds; round++) {
+			if (run_round(regions, handle)) {
+				fprintf(stderr, "command failed with %u regions\n",
+					regions);
+				return 2;
+			}
+		}
+	}
+
+	TA_CloseSessionEntryPoint(session);
+	TA_DestroyEntryPoint();
+
+	print_results();
+
+	if (write && write_thresholds(write, margin))
+		return 2;
+
+	if (check) {
+		ret = check_thresholds(check);
+		if (ret < 0)
+			return 2;
+		if (ret)
+			return 1;
+	}
+
+	return 0;
+}
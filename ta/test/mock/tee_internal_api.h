@@ -0,0 +1,104 @@
+/*
+ * tee_internal_api.h
+ *
+ * Mock of the GP TEE Internal API, with only what the TA core uses, to build
+ * it as a normal userspace program.
+ *
+ * License terms: Lesser GNU General Public License (LGPL), version 2.1
+ */
+#ifndef TEE_INTERNAL_API_H
+#define TEE_INTERNAL_API_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef uint32_t TEE_Result;
+
+typedef union {
+	struct {
+		void *buffer;
+		uint32_t size;
+	} memref;
+	struct {
+		uint32_t a;
+		uint32_t b;
+	} value;
+} TEE_Param;
+
+typedef struct {
+	uint32_t seconds;
+	uint32_t millis;
+} TEE_Time;
+
+#define TEE_SUCCESS			0x00000000
+#define TEE_ERROR_GENERIC		0xFFFF0000
+#define TEE_ERROR_ACCESS_DENIED		0xFFFF0001
+#define TEE_ERROR_BAD_FORMAT		0xFFFF0005
+#define TEE_ERROR_BAD_PARAMETERS	0xFFFF0006
+#define TEE_ERROR_BAD_STATE		0xFFFF0007
+#define TEE_ERROR_ITEM_NOT_FOUND	0xFFFF0008
+#define TEE_ERROR_NOT_SUPPORTED		0xFFFF000A
+#define TEE_ERROR_OUT_OF_MEMORY		0xFFFF000C
+#define TEE_ERROR_BUSY			0xFFFF000D
+#define TEE_ERROR_SHORT_BUFFER		0xFFFF0010
+
+#define TEE_PARAM_TYPE_NONE		0
+#define TEE_PARAM_TYPE_VALUE_INPUT	1
+#define TEE_PARAM_TYPE_VALUE_OUTPUT	2
+#define TEE_PARAM_TYPE_VALUE_INOUT	3
+#define TEE_PARAM_TYPE_MEMREF_INPUT	5
+#define TEE_PARAM_TYPE_MEMREF_OUTPUT	6
+#define TEE_PARAM_TYPE_MEMREF_INOUT	7
+
+#define TEE_PARAM_TYPES(t0, t1, t2, t3) \
+	((t0) | ((t1) << 4) | ((t2) << 8) | ((t3) << 12))
+#define TEE_PARAM_TYPE_GET(t, i)	(((t) >> ((i) * 4)) & 0xF)
+
+/* the TA messages are only printed when TA_LOG is set in the environment */
+#define IMSG(...) \
+	do { \
+		if (getenv("TA_LOG")) \
+			printf(__VA_ARGS__); \
+	} while (0)
+#define DMSG(...)	IMSG(__VA_ARGS__)
+#define EMSG(...)	fprintf(stderr, __VA_ARGS__)
+
+static inline void *TEE_Malloc(uint32_t size, uint32_t hint)
+{
+	(void)hint;
+	return calloc(1, size ? size : 1);
+}
+
+static inline void *TEE_Realloc(void *buffer, uint32_t size)
+{
+	return realloc(buffer, size);
+}
+
+static inline void TEE_Free(void *buffer)
+{
+	free(buffer);
+}
+
+static inline void TEE_GetSystemTime(TEE_Time *time)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	time->seconds = ts.tv_sec;
+	time->millis = ts.tv_nsec / 1000000;
+}
+
+/* entry points of the TA, called by the test programs */
+TEE_Result TA_CreateEntryPoint(void);
+void TA_DestroyEntryPoint(void);
+TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types, TEE_Param params[4],
+				    void **sess_ctx);
+void TA_CloseSessionEntryPoint(void *sess_ctx);
+TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
+				      uint32_t param_types, TEE_Param params[4]);
+
+#endif /* TEE_INTERNAL_API_H */
@@ -0,0 +1,104 @@
+/*
+ * policy_test.c
+ *
+ * Check that the policy table of the STUB platform gives the same answers as
+ * the hand-written checks it replaced, for every writer and reader device
+ * type, including the types without a table row, for the stream types,
+ * with and without low id bits, and for every direction.
+ *
+ * License terms: Lesser GNU General Public License (LGPL), version 2.1
+ */
+
+/* the test needs the layout of struct region and struct secure_device */
+#include "../platform/stub.c"
+
+/* platform_check_permissions() before the policy table, kept as reference */
+static int reference_check_permissions(uint32_t writer, uint32_t device,
+				       int dir)
+{
+	if ((writer == 0) && (dir == DIR_WRITE))
+		return 0;
+
+	if ((writer == device) && (dir == DIR_WRITE))
+		return 0;
+
+	if (IS_CPU(writer) && (dir != DIR_WRITE) && !IS_CPU(device))
+		return 0;
+
+	if (IS_DECODER(writer) && (dir != DIR_WRITE) && IS_TRANSFORMER(device))
+		if (STREAM_TYPE(writer) == STREAM_TYPE(device))
+			return 0;
+
+	if (IS_DECODER(writer) && (dir != DIR_WRITE) && IS_SINK(device))
+		if (STREAM_TYPE(writer) == STREAM_TYPE(device))
+			return 0;
+
+	if (IS_TRANSFORMER(writer) && (dir != DIR_WRITE) && IS_SINK(device))
+		if (STREAM_TYPE(writer) == STREAM_TYPE(device))
+			return 0;
+
+	return 1;
+}
+
+/* no stream type, then the stream types of the platform */
+static const uint32_t streams[] = { 0, VIDEO, AUDIO };
+/* low id bits, a class 0 id with some of them set is not an empty writer */
+static const uint32_t low_bits[] = { 0, 0x1, 0xFFFF };
+/* out of range directions included */
+static const int directions[] = { -1, DIR_RW, DIR_READ, DIR_WRITE, 3, 4 };
+
+#define NB_IDS	(256 * ARRAY_SIZE(streams) * ARRAY_SIZE(low_bits))
+
+/* the n-th device id of the tested set */
+static uint32_t test_id(unsigned int n)
+{
+	unsigned int type = n / (ARRAY_SIZE(streams) * ARRAY_SIZE(low_bits));
+	unsigned int s = n / ARRAY_SIZE(low_bits) % ARRAY_SIZE(streams);
+	unsigned int l = n % ARRAY_SIZE(low_bits);
+
+	return ((uint32_t)type << 24) | streams[s] | low_bits[l];
+}
+
+int main(void)
+{
+	struct region region;
+	struct secure_device device = { "test", 0, NULL, NULL };
+	uint32_t writer_id;
+	unsigned int w, r, d;
+	long checks = 0, errors = 0;
+	int expected, got;
+
+	for (w = 0; w < NB_IDS; w++) {
+		writer_id = test_id(w);
+
+		for (r = 0; r < NB_IDS; r++) {
+			device.id = test_id(r);
+
+			for (d = 0; d < ARRAY_SIZE(directions); d++) {
+				memset(&region, 0, sizeof(region));
+				region.writer = writer_id;
+
+				expected = reference_check_permissions(
+					writer_id, device.id,
+					directions[d]) != 0;
+				got = platform_check_permissions(
+					&region, &device, directions[d]) != 0;
+
+				checks++;
+				if (got == expected)
+					continue;
+
+				if (errors++ < 20)
+					printf("mismatch: writer 0x%x device 0x%x dir %d: table %s, reference %s\n",
+					       writer_id, device.id,
+					       directions[d],
+					       got ? "denies" : "allows",
+					       expected ? "denies" : "allows");
+			}
+		}
+	}
+
+	printf("policy: %ld checks, %ld mismatches\n", checks, errors);
+
+	return errors ? 1 : 0;
+}
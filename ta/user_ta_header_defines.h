@@ -5,7 +5,12 @@
 
 #define TA_UUID TA_SDP_UUID
 
-#define TA_FLAGS                    (TA_FLAG_MULTI_SESSION | TA_FLAG_EXEC_DDR)
+/*
+ * The host opens several sessions in parallel, a single instance keeps one
+ * view of the regions for all of them
+ */
+#define TA_FLAGS                    (TA_FLAG_SINGLE_INSTANCE | \
+				     TA_FLAG_MULTI_SESSION | TA_FLAG_EXEC_DDR)
 #define TA_STACK_SIZE               (2 * 1024)
 #define TA_DATA_SIZE                (32 * 1024)
 